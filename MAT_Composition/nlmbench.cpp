@@ -0,0 +1,428 @@
+/*	Benchmarks for the nlmfinal renderer.
+ 
+ Builds against nlmfinal.cpp with its main() left out. Run with the name of a
+ benchmark:
+ 
+	nlmbench queue [notes]	insert and per-block dispatch cost of EventQueue
+	nlmbench voices [voices] [seconds] [-csv|-json]
+							render cost of each instrument per block size and
+							sample rate
+	nlmbench spectral [seconds]
+							cost of AddSyn's partial bank and of AddSynFFT
+							per partial count
+	nlmbench layout [seconds]
+							size of each instrument and its cache misses per
+							rendered block as the voice count grows
+	nlmbench live [notes/s] [seconds]
+							stress test of play<T>(): a control thread fires
+							notes while a paced audio thread renders
+ 
+ */
+
+#define NLM_NO_MAIN
+#include "nlmfinal.cpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static double nsSince(Clock::time_point t){
+	return std::chrono::duration<double, std::nano>(Clock::now() - t).count();
+}
+
+
+// Inserts a swarm of notes the way the score does (several independent time
+// cursors, short bursts of notes close together) and then drains the queue one
+// 256-frame block at a time.
+void benchQueue(int numNotes){
+	const double fps = 44100.;
+	const int frames = VoiceScheduler::BLOCK_SIZE;
+	const double length = 240;
+	
+	srand(1);
+	std::vector<double> starts(numNotes);
+	double cursors[4] = {0, 0, 0, 0};
+	for(int i=0; i<numNotes; ++i){
+		double& t = cursors[rand() % 4];
+		t += rnd::uni(0.f, float(8 * length / numNotes));
+		if(t > length) t = rnd::uni(0.f, float(length));
+		starts[i] = t;
+	}
+	
+	EventQueue q;
+	q.reserve(numNotes);
+	NoteRecord r = { 0, 0, 1, 0, 0, 0, 0, 0 };
+	Clock::time_point t0 = Clock::now();
+	for(int i=0; i<numNotes; ++i){
+		r.start = starts[i];
+		q.push(r);
+	}
+	double insertNs = nsSince(t0);
+	
+	double worstBlockNs = 0, totalDispatchNs = 0;
+	int blocks = 0;
+	long long dispatched = 0;
+	for(long long frame=0; !q.empty(); frame+=frames, ++blocks){
+		Clock::time_point tb = Clock::now();
+		while(!q.empty() && (long long)(q.top().start * fps + 0.5) < frame + frames){
+			q.pop();
+			++dispatched;
+		}
+		double ns = nsSince(tb);
+		totalDispatchNs += ns;
+		worstBlockNs = std::max(worstBlockNs, ns);
+	}
+	
+	printf("queue: %d notes\n", numNotes);
+	printf("  insert   %8.1f ns/note\n", insertNs / numNotes);
+	printf("  dispatch %8.1f ns/note, %8.1f ns/block average, %8.1f ns/block worst (%d blocks)\n",
+		totalDispatchNs / dispatched, totalDispatchNs / blocks, worstBlockNs, blocks);
+}
+
+
+// L1D and last-level cache read misses of the calling thread, counted by the
+// kernel through perf_event_open. Where it isn't allowed (perf_event_paranoid,
+// a container, a VM without a PMU) or isn't Linux, the counts are -1.
+struct CacheCounters {
+	enum { L1D, LLC, COUNTERS };
+	int mFd[COUNTERS];
+	
+	CacheCounters(){
+		for(int i=0; i<COUNTERS; ++i) mFd[i] = -1;
+#ifdef __linux__
+		static const uint64_t caches[COUNTERS] = { PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL };
+		for(int i=0; i<COUNTERS; ++i){
+			perf_event_attr a;
+			memset(&a, 0, sizeof(a));
+			a.type = PERF_TYPE_HW_CACHE;
+			a.size = sizeof(a);
+			a.config = caches[i] | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			a.disabled = 1;
+			a.exclude_kernel = 1;
+			a.exclude_hv = 1;
+			mFd[i] = int(syscall(__NR_perf_event_open, &a, 0, -1, -1, 0));
+		}
+#endif
+	}
+	
+	~CacheCounters(){
+		for(int i=0; i<COUNTERS; ++i) if(mFd[i] >= 0) close(mFd[i]);
+	}
+	
+	bool available() const { return mFd[L1D] >= 0 || mFd[LLC] >= 0; }
+	
+	void start(){
+#ifdef __linux__
+		for(int i=0; i<COUNTERS; ++i){
+			if(mFd[i] < 0) continue;
+			ioctl(mFd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(mFd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+	
+	// Misses since start() into out[COUNTERS]
+	void stop(long long * out){
+		for(int i=0; i<COUNTERS; ++i){
+			out[i] = -1;
+#ifdef __linux__
+			if(mFd[i] < 0) continue;
+			ioctl(mFd[i], PERF_EVENT_IOC_DISABLE, 0);
+			long long v;
+			if(read(mFd[i], &v, sizeof(v)) == sizeof(v)) out[i] = v;
+#endif
+		}
+	}
+};
+
+// One row of benchVoices
+struct VoiceResult {
+	const char * name;
+	double rate;
+	int block;
+	int voices;
+	double nsPerSample;		// per voice
+	double voicesPerCore;	// voices one core renders in real time
+	double l1dMisses;		// per voice-block, -1 without counters
+	double llcMisses;
+};
+
+// Instruments that play a wavetable get one
+template <class T> void setTable(T&, ArrayPow2<float>&){}
+template <> void setTable(OscTrm& v, ArrayPow2<float>& t){ v.table(t); }
+
+// Time numVoices voices of T, built with their default set(...), rendering
+// seconds of audio through onBlock in blocks of the given size
+template <class T>
+VoiceResult benchVoice(const char * name, double rate, int block, int numVoices, double seconds,
+	ArrayPow2<float> * table=0, CacheCounters * counters=0
+){
+	Sync::master().spu(rate);
+	VoicePool pool(sizeof(T));	// the voices' alignment, as VoiceScheduler lays them out
+	std::vector<T *> voices;
+	for(int i=0; i<numVoices; ++i){
+		voices.push_back(new(pool.alloc()) T);
+		if(table) setTable(*voices.back(), *table);
+	}
+	std::vector<float> L(block), R(block);
+	
+	// one block untimed to touch everything
+	for(int i=0; i<numVoices; ++i) voices[i]->onBlock(&L[0], &R[0], block);
+	
+	long long frames = (long long)(seconds * rate);
+	long long blocks = 0, misses[CacheCounters::COUNTERS];
+	if(counters) counters->start();
+	Clock::time_point t0 = Clock::now();
+	for(long long f=0; f<frames; f+=block, ++blocks){
+		std::fill(L.begin(), L.end(), 0.f);
+		std::fill(R.begin(), R.end(), 0.f);
+		for(int i=0; i<numVoices; ++i) voices[i]->onBlock(&L[0], &R[0], block);
+	}
+	double ns = nsSince(t0);
+	if(counters) counters->stop(misses);
+	for(int i=0; i<numVoices; ++i) voices[i]->~T();
+	
+	VoiceResult r = { name, rate, block, numVoices, 0, 0, -1, -1 };
+	r.nsPerSample = ns / (double(frames) * numVoices);
+	r.voicesPerCore = 1e9 / (r.nsPerSample * rate);
+	double voiceBlocks = double(blocks) * numVoices;
+	if(counters && misses[CacheCounters::L1D] >= 0) r.l1dMisses = misses[CacheCounters::L1D] / voiceBlocks;
+	if(counters && misses[CacheCounters::LLC] >= 0) r.llcMisses = misses[CacheCounters::LLC] / voiceBlocks;
+	return r;
+}
+
+enum Format { TEXT, CSV, JSON };
+
+void benchVoices(int numVoices, double seconds, Format format){
+	static const double rates[] = { 44100, 48000, 96000 };
+	static const int blocks[] = { 64, 128, 256, 512, 1024, 2048, 4096 };
+	
+	// the table the piece plays OscTrm's flute with
+	ArrayPow2<float> tbSqr(2048);
+	addSinesPow<1>(tbSqr, 9,2);
+	TableMips mipSqr(tbSqr);	// found by OscTrm::table()
+	
+	std::vector<VoiceResult> results;
+	for(unsigned r=0; r<sizeof(rates)/sizeof(*rates); ++r){
+		for(unsigned b=0; b<sizeof(blocks)/sizeof(*blocks); ++b){
+			double rate = rates[r];
+			int block = blocks[b];
+			results.push_back(benchVoice<SineEnv>("SineEnv", rate, block, numVoices, seconds));
+			results.push_back(benchVoice<OscTrm >("OscTrm",  rate, block, numVoices, seconds, &tbSqr));
+			results.push_back(benchVoice<AddSyn >("AddSyn",  rate, block, numVoices, seconds));
+			results.push_back(benchVoice<Chimes >("Chimes",  rate, block, numVoices, seconds));
+			results.push_back(benchVoice<Trumpet>("Trumpet", rate, block, numVoices, seconds));
+		}
+	}
+	
+	if(format == CSV) printf("instrument,rate,block,voices,ns_per_sample_voice,voices_per_core\n");
+	else if(format == JSON) printf("[\n");
+	else printf("%-8s %6s %5s %6s %12s %12s\n", "voice", "rate", "block", "voices", "ns/sample", "voices/core");
+	for(unsigned i=0; i<results.size(); ++i){
+		const VoiceResult& r = results[i];
+		if(format == CSV)
+			printf("%s,%g,%d,%d,%.3f,%.1f\n", r.name, r.rate, r.block, r.voices, r.nsPerSample, r.voicesPerCore);
+		else if(format == JSON)
+			printf("  {\"instrument\": \"%s\", \"rate\": %g, \"block\": %d, \"voices\": %d, "
+				"\"ns_per_sample_voice\": %.3f, \"voices_per_core\": %.1f}%s\n",
+				r.name, r.rate, r.block, r.voices, r.nsPerSample, r.voicesPerCore, i+1 < results.size() ? "," : "");
+		else
+			printf("%-8s %6g %5d %6d %12.2f %12.0f\n", r.name, r.rate, r.block, r.voices, r.nsPerSample, r.voicesPerCore);
+	}
+	if(format == JSON) printf("]\n");
+}
+
+
+// Memory footprint of each instrument and what it costs in cache misses as
+// the voices outgrow the caches: sizeof, the pool slot it takes (in 64-byte
+// lines), and per voice-block (256 frames at 44.1 kHz) the L1D and
+// last-level read misses, with the time per sample and voices per core.
+void benchLayout(double seconds){
+	const double rate = 44100.;
+	const int block = VoiceScheduler::BLOCK_SIZE;
+	static const int counts[] = { 16, 256, 4096 };
+	
+	ArrayPow2<float> tbSqr(2048);
+	addSinesPow<1>(tbSqr, 9,2);
+	TableMips mipSqr(tbSqr);
+	
+	struct Size { const char * name; size_t size; };
+	const Size sizes[] = {
+		{ "SineEnv", sizeof(SineEnv) }, { "OscTrm", sizeof(OscTrm) }, { "AddSyn", sizeof(AddSyn) },
+		{ "Chimes", sizeof(Chimes) }, { "Trumpet", sizeof(Trumpet) }, { "AddSynFFT", sizeof(AddSynFFT) },
+		{ "ChimeCloud", sizeof(ChimeCloud) }
+	};
+	printf("%-10s %8s %8s %6s\n", "voice", "sizeof", "slot", "lines");
+	for(unsigned i=0; i<sizeof(sizes)/sizeof(*sizes); ++i){
+		size_t slot = VoicePool(sizes[i].size, 1).slotSize();
+		printf("%-10s %8d %8d %6d\n", sizes[i].name, int(sizes[i].size), int(slot), int(slot / 64));
+	}
+	
+	CacheCounters counters;
+	if(!counters.available()) printf("\n(cache counters unavailable: %s)\n", strerror(errno));
+	std::vector<VoiceResult> results;
+	for(unsigned c=0; c<sizeof(counts)/sizeof(*counts); ++c){
+		int n = counts[c];
+		results.push_back(benchVoice<SineEnv>("SineEnv", rate, block, n, seconds, 0, &counters));
+		results.push_back(benchVoice<OscTrm >("OscTrm",  rate, block, n, seconds, &tbSqr, &counters));
+		results.push_back(benchVoice<AddSyn >("AddSyn",  rate, block, n, seconds, 0, &counters));
+		results.push_back(benchVoice<Chimes >("Chimes",  rate, block, n, seconds, 0, &counters));
+	}
+	printf("\n%-8s %6s %12s %12s %12s %12s\n", "voice", "voices", "L1D miss/blk", "LLC miss/blk", "ns/sample", "voices/core");
+	for(unsigned i=0; i<results.size(); ++i){
+		const VoiceResult& r = results[i];
+		char l1d[16] = "n/a", llc[16] = "n/a";
+		if(r.l1dMisses >= 0) snprintf(l1d, sizeof(l1d), "%.1f", r.l1dMisses);
+		if(r.llcMisses >= 0) snprintf(llc, sizeof(llc), "%.1f", r.llcMisses);
+		printf("%-8s %6d %12s %12s %12.2f %12.0f\n", r.name, r.voices, l1d, llc, r.nsPerSample, r.voicesPerCore);
+	}
+}
+
+
+// Render cost of AddSyn's partial bank against the inverse-FFT backend as
+// partials are added (AddSyn itself stops at nine)
+void benchSpectral(double seconds){
+	const double fps = 44100.;
+	const int block = VoiceScheduler::BLOCK_SIZE;
+	Sync::master().spu(fps);
+	static const int counts[] = { 9, 16, 32, 64, 128, 256 };
+	
+	printf("%-10s %12s %12s\n", "partials", "bank ns/smp", "FFT ns/smp");
+	std::vector<float> L(block), R(block);
+	long long frames = (long long)(seconds * fps);
+	for(unsigned c=0; c<sizeof(counts)/sizeof(*counts); ++c){
+		int n = counts[c];
+		
+		PartialBank<256> bank;
+		for(int j=0; j<n; ++j) bank.add(1 + j*0.37f, j % 3);
+		bank.tune(155.6f);
+		alignas(32) float g0[block], g1[block], g2[block];
+		float * groups[3] = { g0, g1, g2 };
+		Clock::time_point t0 = Clock::now();
+		for(long long f=0; f<frames; f+=block) bank.render(groups, block);
+		double bankNs = nsSince(t0) / frames;
+		
+		AddSynFFT v;
+		v.dur(seconds * 2);
+		for(int j=9; j<n; ++j) v.partial(1 + j*0.37f, j % 3);
+		v.onBlock(&L[0], &R[0], block);	// untimed, builds the shared tables
+		t0 = Clock::now();
+		for(long long f=0; f<frames; f+=block) v.onBlock(&L[0], &R[0], block);
+		double fftNs = nsSince(t0) / frames;
+		
+		printf("%-10d %12.1f %12.1f\n", n, bankNs, fftNs);
+	}
+}
+
+
+// A control thread plays short Chimes and OscTrm notes at notesPerSecond
+// while this thread renders 256-frame blocks paced to real time, as audioCB
+// would be called. Reports notes the ring or the voice pools turned away and
+// the block times against their budget.
+void benchLive(int notesPerSecond, double seconds){
+	const double fps = 44100.;
+	const int frames = VoiceScheduler::BLOCK_SIZE;
+	Sync::master().spu(fps);
+	
+	ArrayPow2<float> tbSqr(2048);
+	addSinesPow<1>(tbSqr, 9,2);
+	TableMips mipSqr(tbSqr);
+	
+	// notes are 0.1 s long and ring out a little after that
+	size_t voices = size_t(notesPerSecond * 0.4) + 64;
+	VoiceScheduler s;
+	s.threads(1).profile(true);
+	s.reserve<Chimes>(voices).reserve<OscTrm>(voices);
+	
+	std::atomic<bool> running(true);
+	std::atomic<unsigned> sent(0), rejected(0);
+	std::thread control([&]{
+		srand(1);
+		float chime[Chimes::NUM_PARAMS];
+		std::copy(Chimes::defaults(), Chimes::defaults() + Chimes::NUM_PARAMS, chime);
+		chime[0] = 0.1;		// dur
+		chime[5] = 0.05;	// decayStri
+		chime[9] = 0.05;	// decayLow
+		chime[13] = 0.05;	// decayUp
+		Clock::time_point start = Clock::now();
+		for(unsigned n=0; running; ++n){
+			std::this_thread::sleep_until(start + std::chrono::nanoseconds((long long)(n * 1e9 / notesPerSecond)));
+			bool ok;
+			if(n & 1){
+				chime[1] = rnd::uni(200.f, 2000.f);
+				ok = s.playArray<Chimes>(chime, Chimes::NUM_PARAMS);
+			}
+			else {
+				ok = s.play<OscTrm>(0.1f, rnd::uni(200.f, 1500.f), 0.05f, 0.01f, 0.05f, 0.8f, 0.4f,4.f,8.f,0.5f, tbSqr, 0.f);
+			}
+			++sent;
+			if(!ok) ++rejected;
+		}
+	});
+	
+	std::vector<float> L(frames), R(frames);
+	int blocks = int(seconds * fps / frames);
+	Clock::time_point start = Clock::now();
+	for(int b=0; b<blocks; ++b){
+		std::this_thread::sleep_until(start + std::chrono::nanoseconds((long long)(b * frames * 1e9 / fps)));
+		std::fill(L.begin(), L.end(), 0.f);
+		std::fill(R.begin(), R.end(), 0.f);
+		s.process(&L[0], &R[0], frames);
+	}
+	running = false;
+	control.join();
+	
+	printf("live: %d notes/s for %g s\n", notesPerSecond, seconds);
+	printf("  sent %u, ring full %u, no free voice %u\n", unsigned(sent), unsigned(rejected), s.liveDropped());
+	s.printStats();
+	s.printProfile();
+}
+
+
+int main(int argc, char * argv[]){
+	const char * which = argc > 1 ? argv[1] : "queue";
+	
+	if(!strcmp(which, "queue")){
+		if(argc > 2) benchQueue(atoi(argv[2]));
+		else {
+			benchQueue(10000);
+			benchQueue(100000);
+			benchQueue(1000000);
+		}
+	}
+	else if(!strcmp(which, "voices")){
+		Format format = TEXT;
+		std::vector<const char *> args;
+		for(int i=2; i<argc; ++i){
+			if(!strcmp(argv[i], "-csv")) format = CSV;
+			else if(!strcmp(argv[i], "-json")) format = JSON;
+			else args.push_back(argv[i]);
+		}
+		int numVoices = args.size() > 0 ? atoi(args[0]) : 16;
+		double seconds = args.size() > 1 ? atof(args[1]) : 0.5;
+		benchVoices(numVoices, seconds, format);
+	}
+	else if(!strcmp(which, "spectral")){
+		benchSpectral(argc > 2 ? atof(argv[2]) : 2);
+	}
+	else if(!strcmp(which, "layout")){
+		benchLayout(argc > 2 ? atof(argv[2]) : 0.2);
+	}
+	else if(!strcmp(which, "live")){
+		int rate = argc > 2 ? atoi(argv[2]) : 2000;
+		double seconds = argc > 3 ? atof(argv[3]) : 5;
+		benchLive(rate, seconds);
+	}
+	else {
+		printf("unknown benchmark %s\n", which);
+		return 1;
+	}
+	return 0;
+}
@@ -14,14 +14,704 @@
 using namespace gam;
 #include "allocore/io/al_App.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <typeinfo>
+#include <unistd.h>
+#include <vector>
 
-struct SineEnv : public Process<AudioIOData> {
+
+// ************************************************************************
+// Block kernels
+//
+// The instruments render a whole block at a time through these. Oscillators
+// keep a 32-bit phase (one full cycle = 2^32) so the increment is exact and
+// wrapping is free. The loops are plain and branch free so the compiler can
+// vectorize them (SSE/AVX at -O2 -ftree-vectorize or -O3).
+
+static const int VOICE_BLOCK = 256;	// frames a voice renders per pass
+
+inline uint32_t phaseInc(float freq){
+	return uint32_t(int64_t(double(freq) / Sync::master().spu() * 4294967296.));
+}
+
+// sin(2 pi x) for x in [-0.5, 0.5), max error about 1e-6
+inline float sinCycle(float x){
+	x = x > 0.25f ? 0.5f - x : (x < -0.25f ? -0.5f - x : x);
+	float z = x * 6.28318531f, z2 = z*z;
+	return z*(1.f + z2*(-1.f/6 + z2*(1.f/120 + z2*(-1.f/5040 + z2*(1.f/362880 + z2*(-1.f/39916800))))));
+}
+
+// Reading the phase as signed maps it onto [-0.5, 0.5) cycles
+inline float phaseToCycle(uint32_t phase){
+	return float(int32_t(phase)) * (1.f/4294967296.f);
+}
+
+// out[i] = sin(phase), advancing phase by inc each frame
+inline void sineBlock(float * out, uint32_t& phase, uint32_t inc, int n){
+	uint32_t p = phase;
+	for(int i=0; i<n; ++i) out[i] = sinCycle(phaseToCycle(p + uint32_t(i)*inc));
+	phase = p + uint32_t(n)*inc;
+}
+
+// out[i] += sin(phase), advancing phase by inc each frame
+inline void sineBlockAdd(float * out, uint32_t& phase, uint32_t inc, int n){
+	uint32_t p = phase;
+	for(int i=0; i<n; ++i) out[i] += sinCycle(phaseToCycle(p + uint32_t(i)*inc));
+	phase = p + uint32_t(n)*inc;
+}
+
+// Linearly interpolated table oscillator; table size must be 2^bits
+inline void tableBlock(float * out, const float * table, int bits, uint32_t& phase, uint32_t inc, int n){
+	uint32_t p = phase;
+	uint32_t mask = (1u << bits) - 1;
+	int shift = 32 - bits;
+	for(int i=0; i<n; ++i){
+		uint32_t idx = p >> shift;
+		float frac = float((p << bits) >> 8) * (1.f/16777216.f);
+		float a = table[idx], b = table[(idx+1) & mask];
+		out[i] = a + (b - a)*frac;
+		p += inc;
+	}
+	phase = p;
+}
+
+// Mono signal into the stereo outputs with fixed gains
+inline void panBlock(float * outL, float * outR, const float * in, float gainL, float gainR, int n){
+	for(int i=0; i<n; ++i){
+		outL[i] += in[i] * gainL;
+		outR[i] += in[i] * gainR;
+	}
+}
+
+// panBlock with both gains equal: one multiply per frame
+inline void panBlockMono(float * outL, float * outR, const float * in, float gain, int n){
+	for(int i=0; i<n; ++i){
+		float v = in[i] * gain;
+		outL[i] += v;
+		outR[i] += v;
+	}
+}
+
+// panBlock, or panBlockMono for voices whose pan gains are equal
+template <bool Mono>
+inline void panOut(float * outL, float * outR, const float * in, float gainL, float gainR, int n){
+	if(Mono) panBlockMono(outL, outR, in, gainL, n);
+	else panBlock(outL, outR, in, gainL, gainR, n);
+}
+
+// Envelope values for the next n frames
+template <class E>
+inline void envBlock(float * out, E& env, int n){
+	for(int i=0; i<n; ++i) out[i] = env();
+}
+
+// The segments of an Env<N> in closed form, so a block path can evaluate it
+// once every K frames and interpolate in between. Over a segment of length
+// len with curvature c the value goes from a to b as
+//	a + (b-a) (1 - e^(c t)) / (1 - e^c),  t = frames into the segment / len
+// (linear for c = 0), the shape of Gamma's Env. The position is kept here,
+// so a voice using it asks it, not the Env, whether it is done.
+template <int N>
+struct EnvCurve {
+	double mPos;		// frames since the start
+	float mLen[N];		// frames
+	float mLev[N+1];
+	float mCurve;
+	
+	EnvCurve(): mPos(0), mCurve(0) {}
+	
+	// Take the lengths and levels of env, which has curvature c
+	template <class E>
+	void shape(E& env, float c){
+		float spu = Sync::master().spu();
+		for(int i=0; i<N; ++i) mLen[i] = env.lengths()[i] * spu;
+		for(int i=0; i<=N; ++i) mLev[i] = env.levels()[i];
+		mCurve = c;
+	}
+	
+	// Segment at pos, N when past the end
+	int stage(double pos) const {
+		for(int i=0; i<N; ++i){
+			if(pos < mLen[i]) return i;
+			pos -= mLen[i];
+		}
+		return N;
+	}
+	int stage() const { return stage(mPos); }
+	bool done() const { return stage() == N; }
+	
+	// Largest value over [pos, pos+n]. Each segment is monotonic, so the
+	// two ends and the segment starts in between are enough.
+	float peak(double pos, double n) const {
+		float p = std::max(value(pos), value(pos + n));
+		double start = 0;
+		for(int i=0; i<N; ++i){
+			if(start > pos && start < pos + n) p = std::max(p, mLev[i]);
+			start += mLen[i];
+		}
+		return p;
+	}
+	
+	float value(double pos) const {
+		for(int i=0; i<N; ++i){
+			if(pos < mLen[i]){
+				float t = float(pos / mLen[i]);
+				float w = mCurve == 0 ? t : (1.f - std::exp(mCurve*t)) / (1.f - std::exp(mCurve));
+				return mLev[i] + (mLev[i+1] - mLev[i]) * w;
+			}
+			pos -= mLen[i];
+		}
+		return mLev[N];
+	}
+	
+	// Frames between exact values at pos: at most K, stopping at the end of
+	// the segment, and short enough that a segment gets 8 of them so quick
+	// attacks keep their curve
+	int step(double pos, int K) const {
+		double end = 0;
+		for(int i=0; i<N; ++i){
+			end += mLen[i];
+			if(pos < end){
+				double m = std::min(std::min(double(K), end - pos), mLen[i] / 8.);
+				return std::max(1, int(std::ceil(m)));
+			}
+		}
+		return K;
+	}
+	
+	// The next n frames, exact every K frames and at segment starts, linear
+	// in between
+	void render(float * out, int n, int K){
+		double pos = mPos;
+		for(int i=0; i<n;){
+			int m = step(pos, K);
+			float v0 = value(pos);
+			float dv = (value(pos + m) - v0) / m;
+			int end = std::min(n, i + m);
+			for(int k=0; i<end; ++i, ++k) out[i] = v0 + dv*k;
+			pos += m;
+		}
+		mPos += n;
+	}
+};
+
+// Gains of a fixed Pan<>, computed with the same call pattern the per-sample
+// paths use so the block paths pan identically
+inline void panGains(Pan<>& pan, float& gainL, float& gainR){
+	gainL = 1.f;
+	pan(gainL, gainL, gainR);
+}
+
+// Largest |in[i]|
+inline float blockPeak(const float * in, int n){
+	float peak = 0.f;
+	for(int i=0; i<n; ++i) peak = std::max(peak, std::fabs(in[i]));
+	return peak;
+}
+
+inline int log2Size(unsigned size){
+	int bits = 0;
+	while((1u << bits) < size) ++bits;
+	return bits;
+}
+
+
+// Level of detail for the additive voices. A partial is skipped for a block
+// when it is at or above Nyquist, or when its gain over the block is below
+// relative() times the voice's loudest partial, or below -120 dBFS outright.
+// A skipped partial's phase keeps running, so it comes back in place once it
+// is loud enough again. The counters are partial-samples summed over every
+// voice (for -stats); voices add to them once per block.
+struct PartialLod {
+	// Threshold below the voice's loudest partial; 0 (the default, as the
+	// cut is audible in principle) renders every partial
+	static float& relative(){ static float r = 0; return r; }
+	static void threshold(float dB){ relative() = dB < 0 ? std::pow(10.f, dB/20) : 0; }
+	static bool enabled(){ return relative() > 0; }
+	
+	// Lowest gain worth rendering in a voice whose loudest partial has level
+	static float cut(float level){ return enabled() ? std::max(level * relative(), 1e-6f) : 0.f; }
+	
+	// Whether a partial of cycles per sample is below Nyquist. Compare before
+	// it becomes a phase increment: the increment wraps at the sample rate.
+	static bool belowNyquist(double cycles){ return cycles < 0.5; }
+	
+	// Whether to leave out a partial for not being below Nyquist
+	static bool aliased(bool belowNyquist){ return enabled() && !belowNyquist; }
+	
+	static std::atomic<long long>& rendered(){ static std::atomic<long long> n(0); return n; }
+	static std::atomic<long long>& skipped(){ static std::atomic<long long> n(0); return n; }
+	static void count(long long r, long long s){
+		if(r) rendered() += r;
+		if(s) skipped() += s;
+	}
+};
+
+
+// Bank of sine partials stored as parallel arrays (phase, increment, group,
+// ratio to the fundamental). Partials are summed per group into separate
+// buffers so an instrument can weight each group with its own envelope.
+// What render reads comes first; the ratios are only read by tune.
+template <int MaxPartials>
+struct PartialBank {
+	uint32_t mPhase[MaxPartials];
+	uint32_t mInc[MaxPartials];
+	uint8_t mGroup[MaxPartials];
+	bool mBelowNyquist[MaxPartials];	// set by tune
+	int mSize;
+	int mGroups;
+	float mRatio[MaxPartials];
+	
+	PartialBank(): mSize(0), mGroups(0) {}
+	
+	// Append a partial; returns its index
+	int add(float ratio, int group){
+		mRatio[mSize] = ratio;
+		mPhase[mSize] = 0;
+		mInc[mSize] = 0;
+		mGroup[mSize] = group;
+		mBelowNyquist[mSize] = true;
+		if(group >= mGroups) mGroups = group+1;
+		return mSize++;
+	}
+	
+	int size() const { return mSize; }
+	int groups() const { return mGroups; }
+	float ratio(int i) const { return mRatio[i]; }
+	void ratio(int i, float v){ mRatio[i] = v; }
+	
+	// Set the increments for a fundamental frequency
+	void tune(float fundamental){
+		float ups = 1.f / Sync::master().spu();
+		for(int j=0; j<mSize; ++j){
+			double cycles = double(mRatio[j] * fundamental * ups);
+			mInc[j] = uint32_t(int64_t(cycles * 4294967296.));
+			mBelowNyquist[j] = PartialLod::belowNyquist(cycles);
+		}
+	}
+	
+	// One frame of every group sum into out[0..groups)
+	void next(float * out){
+		for(int g=0; g<mGroups; ++g) out[g] = 0.f;
+		for(int j=0; j<mSize; ++j) out[mGroup[j]] += sinCycle(phaseToCycle(mPhase[j]));
+		for(int j=0; j<mSize; ++j) mPhase[j] += mInc[j];
+	}
+	
+	// Which partials are worth rendering (see PartialLod) when group g peaks
+	// at gain[g] over the next block; returns how many
+	int audible(const float * gain, bool * live) const {
+		float level = 0.f;
+		for(int g=0; g<mGroups; ++g) level = std::max(level, gain[g]);
+		float cut = PartialLod::cut(level);
+		int count = 0;
+		for(int j=0; j<mSize; ++j){
+			live[j] = gain[mGroup[j]] >= cut && !PartialLod::aliased(mBelowNyquist[j]);
+			count += live[j];
+		}
+		return count;
+	}
+	
+	// n frames of every group sum into out[g][0..n), leaving out the
+	// partials that aren't live (their phases still advance)
+	void render(float * const * out, int n, const bool * live=0){
+		for(int g=0; g<mGroups; ++g)
+			for(int i=0; i<n; ++i) out[g][i] = 0.f;
+		for(int j=0; j<mSize; ++j){
+			if(live && !live[j]) continue;
+			float * o = out[mGroup[j]];
+			uint32_t p = mPhase[j], inc = mInc[j];
+			for(int i=0; i<n; ++i) o[i] += sinCycle(phaseToCycle(p + uint32_t(i)*inc));
+		}
+		for(int j=0; j<mSize; ++j) mPhase[j] += mInc[j] * uint32_t(n);
+	}
+};
+
+
+// Inverse-FFT additive synthesis (FFT^-1, Rodet and Depalle). Every HOP
+// frames each partial adds the spectrum of a Blackman-Harris windowed
+// sinusoid to one spectrum: the window's main lobe, KERNEL bins either side of
+// the partial, read from a table. An inverse real FFT turns the spectrum into
+// a windowed frame. The middle 2*HOP samples of the frame are reshaped from
+// the window to a triangle and overlap-added, so each partial's amplitude
+// moves linearly from one frame center to the next. The cost per hop is one
+// FFT plus a few bins per partial, so it hardly grows with the partial count.
+// Amplitudes only change at frame centers: an envelope segment shorter than
+// HOP frames is smoothed out to about HOP frames.
+template <int MaxPartials>
+struct SpectralBank {
+	enum { SIZE = 512, HOP = 128, HALF = SIZE/2, KERNEL = 4, OVERSAMPLE = 64 };
+	
+	float mRatio[MaxPartials];
+	float mAmp[MaxPartials];
+	int mGroup[MaxPartials];
+	uint32_t mPhase[MaxPartials];	// at the next frame's center
+	uint32_t mInc[MaxPartials];
+	bool mBelowNyquist[MaxPartials];	// set by tune
+	int mSize;
+	long long mFrame;				// index of the next frame
+	float mSeg[HOP];				// output between the last two frame centers
+	float mTail[HOP];				// the last frame's second half
+	int mRead;						// next sample of mSeg, HOP when used up
+	
+	SpectralBank(): mSize(0), mFrame(0), mRead(HOP) {
+		for(int i=0; i<HOP; ++i) mTail[i] = 0.f;
+	}
+	
+	// Append a partial; returns its index
+	int add(float ratio, int group, float amp=1){
+		if(mSize == MaxPartials) return -1;
+		mRatio[mSize] = ratio;
+		mAmp[mSize] = amp;
+		mGroup[mSize] = group;
+		mPhase[mSize] = 0;
+		mInc[mSize] = 0;
+		mBelowNyquist[mSize] = true;
+		return mSize++;
+	}
+	
+	int size() const { return mSize; }
+	void ratio(int i, float v){ mRatio[i] = v; }
+	
+	// Set the increments for a fundamental frequency (as PartialBank does)
+	void tune(float fundamental){
+		float ups = 1.f / Sync::master().spu();
+		for(int j=0; j<mSize; ++j){
+			double cycles = double(mRatio[j] * fundamental * ups);
+			mInc[j] = uint32_t(int64_t(cycles * 4294967296.));
+			mBelowNyquist[j] = PartialLod::belowNyquist(cycles);
+		}
+	}
+	
+	// Whether read needs the next frame first, and that frame's center
+	bool needFrame() const { return mRead == HOP; }
+	long long frameTime() const { return mFrame * HOP; }
+	
+	// Synthesize the next frame with the given gain per group, leaving out
+	// partials PartialLod finds inaudible; returns how many went in
+	int frame(const float * groupGain){
+		const Tables& t = tables();
+		alignas(32) float re[HALF+1], im[HALF+1];
+		for(int k=0; k<=HALF; ++k) re[k] = im[k] = 0.f;
+		
+		float level = 0.f;
+		for(int j=0; j<mSize; ++j) level = std::max(level, std::fabs(0.5f * mAmp[j] * groupGain[mGroup[j]]));
+		float cut = PartialLod::cut(level);
+		
+		int count = 0;
+		float binsPerInc = SIZE / 4294967296.f;
+		for(int j=0; j<mSize; ++j){
+			float a = 0.5f * mAmp[j] * groupGain[mGroup[j]];
+			float bin = float(mInc[j]) * binsPerInc;
+			if(a != 0.f && std::fabs(a) >= cut && mBelowNyquist[j]){
+				++count;
+				// e^(i (phase - 1/4 cycle)), so the partial comes out as a sine
+				float c = sinCycle(phaseToCycle(mPhase[j]));
+				float s = -sinCycle(phaseToCycle(mPhase[j] + 0x40000000u));
+				int first = int(std::ceil(bin - KERNEL));
+				for(int b=first; b<=bin + KERNEL; ++b){
+					float x = (float(b) - bin + KERNEL + 1) * OVERSAMPLE;
+					int xi = int(x);
+					float w = t.kernel[xi] + (t.kernel[xi+1] - t.kernel[xi]) * (x - xi);
+					w *= (b & 1) ? -a : a;		// centers the frame in the FFT buffer
+					if(b >= 0 && b <= HALF){ re[b] += w*c; im[b] += w*s; }
+					if(b <= 0){ re[-b] += w*c; im[-b] -= w*s; }
+					if(b >= HALF){ re[SIZE-b] += w*c; im[SIZE-b] -= w*s; }
+				}
+			}
+			mPhase[j] += mInc[j] * uint32_t(HOP);
+		}
+		
+		// inverse real FFT through a half size complex one
+		alignas(32) float zr[HALF], zi[HALF];
+		for(int k=0; k<HALF; ++k){
+			float xr = re[k], xi = im[k];
+			float cr = re[HALF-k], ci = -im[HALF-k];
+			float er = xr + cr, ei = xi + ci;
+			float dr = xr - cr, di = xi - ci;
+			float orr = dr * t.rotRe[k] - di * t.rotIm[k];
+			float oi = dr * t.rotIm[k] + di * t.rotRe[k];
+			zr[k] = er - oi;
+			zi[k] = ei + orr;
+		}
+		ifft(zr, zi, t);
+		
+		// samples HALF-HOP .. HALF+HOP of the frame, as a triangle
+		const int from = HALF - HOP;
+		for(int i=0; i<HOP; ++i){
+			int n = from + i;
+			float x = (n & 1) ? zi[n >> 1] : zr[n >> 1];
+			mSeg[i] = mTail[i] + x * t.shape[i];
+		}
+		for(int i=0; i<HOP; ++i){
+			int n = HALF + i;
+			mTail[i] = ((n & 1) ? zi[n >> 1] : zr[n >> 1]) * t.shape[HOP + i];
+		}
+		mRead = mFrame++ ? 0 : HOP;		// frame 0's first half is before the note
+		return count;
+	}
+	
+	// Up to n samples into out; returns how many
+	int read(float * out, int n){
+		int m = std::min(n, HOP - mRead);
+		for(int i=0; i<m; ++i) out[i] = mSeg[mRead + i];
+		mRead += m;
+		return m;
+	}
+	
+private:
+	struct Tables {
+		float kernel[(2*KERNEL + 2) * OVERSAMPLE + 2];	// window spectrum from -KERNEL-1 bins
+		float shape[2*HOP];		// triangle / window / SIZE
+		float rotRe[HALF], rotIm[HALF];	// e^(i 2 pi k / SIZE)
+		float twRe[HALF/2], twIm[HALF/2];	// e^(i 2 pi k / HALF)
+		int reverse[HALF];
+		
+		Tables(){
+			static const double a[4] = { 0.35875, 0.48829, 0.14128, 0.01168 };
+			std::vector<double> w(SIZE);	// centered on SIZE/2
+			for(int n=0; n<SIZE; ++n){
+				double x = 2*M_PI * (n - HALF) / SIZE;
+				w[n] = a[0] + a[1]*std::cos(x) + a[2]*std::cos(2*x) + a[3]*std::cos(3*x);
+			}
+			for(int i=0; i<int(sizeof(kernel)/sizeof(*kernel)); ++i){
+				double d = double(i) / OVERSAMPLE - (KERNEL + 1), sum = 0;
+				for(int n=0; n<SIZE; ++n) sum += w[n] * std::cos(2*M_PI * d * (n - HALF) / SIZE);
+				kernel[i] = float(sum);
+			}
+			for(int i=0; i<2*HOP; ++i){
+				int n = HALF - HOP + i;
+				double tri = 1. - std::fabs(double(n - HALF)) / HOP;
+				shape[i] = float(tri / w[n] / SIZE);
+			}
+			for(int k=0; k<HALF; ++k){
+				rotRe[k] = float(std::cos(2*M_PI*k / SIZE));
+				rotIm[k] = float(std::sin(2*M_PI*k / SIZE));
+			}
+			for(int k=0; k<HALF/2; ++k){
+				twRe[k] = float(std::cos(2*M_PI*k / HALF));
+				twIm[k] = float(std::sin(2*M_PI*k / HALF));
+			}
+			int bits = log2Size(HALF);
+			for(int i=0; i<HALF; ++i){
+				int r = 0;
+				for(int b=0; b<bits; ++b) r |= ((i >> b) & 1) << (bits-1-b);
+				reverse[i] = r;
+			}
+		}
+	};
+	
+	static const Tables& tables(){ static Tables t; return t; }
+	
+	// In place inverse complex FFT of size HALF, unnormalized
+	static void ifft(float * re, float * im, const Tables& t){
+		for(int i=0; i<HALF; ++i){
+			int j = t.reverse[i];
+			if(j > i){ std::swap(re[i], re[j]); std::swap(im[i], im[j]); }
+		}
+		for(int len=2; len<=HALF; len<<=1){
+			int half = len/2, step = HALF/len;
+			for(int i=0; i<HALF; i+=len){
+				for(int k=0; k<half; ++k){
+					float wr = t.twRe[k*step], wi = t.twIm[k*step];
+					int a = i+k, b = a+half;
+					float tr = re[b]*wr - im[b]*wi;
+					float ti = re[b]*wi + im[b]*wr;
+					re[b] = re[a] - tr; im[b] = im[a] - ti;
+					re[a] += tr; im[a] += ti;
+				}
+			}
+		}
+	}
+};
+
+
+// Per-octave band-limited versions of a wavetable. Level L keeps harmonics
+// up to size/2 >> L, so a note picks the first level whose top harmonic (or
+// the table's highest, if that is lower) stays under Nyquist. Levels that
+// wouldn't drop anything the table contains are the table itself. The levels
+// are filtered through an FFT of the table (well under a millisecond for all
+// of them). Mips register themselves so an instrument can find them from the
+// table it was given.
+struct TableMips {
+	
+	TableMips(ArrayPow2<float>& table): mTable(&table), mHighest(0) {
+		build();
+		registry().push_back(this);
+	}
+	
+	~TableMips(){
+		std::vector<TableMips *>& r = registry();
+		r.erase(std::remove(r.begin(), r.end(), this), r.end());
+	}
+	
+	// Level to play freq with without aliasing
+	ArrayPow2<float>& forFreq(float freq){
+		double limit = Sync::master().spu() * 0.5 / std::fabs(freq);
+		unsigned top = mTable->size() / 2;
+		unsigned L = 0;
+		while(L+1 < mLevels.size() && std::min(top >> L, mHighest) > limit) ++L;
+		return *mLevels[L];
+	}
+	
+	// Mips of table, or 0 if none were made
+	static TableMips * find(const ArrayPow2<float>& table){
+		std::vector<TableMips *>& r = registry();
+		for(unsigned i=0; i<r.size(); ++i) if(r[i]->mTable == &table) return r[i];
+		return 0;
+	}
+	
+private:
+	ArrayPow2<float> * mTable;
+	unsigned mHighest;		// highest harmonic the table contains
+	std::vector<ArrayPow2<float> *> mLevels;
+	std::vector<std::unique_ptr<ArrayPow2<float> > > mOwned;
+	
+	TableMips(const TableMips&);
+	TableMips& operator=(const TableMips&);
+	
+	static std::vector<TableMips *>& registry(){
+		static std::vector<TableMips *> r;
+		return r;
+	}
+	
+	// In place complex FFT of a power of two size, unnormalized; sign is the
+	// exponent's (-1 forward, 1 inverse)
+	static void fft(std::vector<double>& re, std::vector<double>& im, int sign){
+		unsigned N = unsigned(re.size());
+		for(unsigned i=1, j=0; i<N; ++i){
+			unsigned bit = N >> 1;
+			for(; j & bit; bit >>= 1) j ^= bit;
+			j ^= bit;
+			if(i < j){ std::swap(re[i], re[j]); std::swap(im[i], im[j]); }
+		}
+		std::vector<double> twRe(N/2), twIm(N/2);
+		for(unsigned k=0; k<N/2; ++k){
+			twRe[k] = std::cos(2*M_PI*k/N);
+			twIm[k] = sign * std::sin(2*M_PI*k/N);
+		}
+		for(unsigned len=2; len<=N; len<<=1){
+			unsigned half = len/2, step = N/len;
+			for(unsigned i=0; i<N; i+=len){
+				for(unsigned k=0; k<half; ++k){
+					double wr = twRe[k*step], wi = twIm[k*step];
+					unsigned a = i+k, b = a+half;
+					double tr = re[b]*wr - im[b]*wi;
+					double ti = re[b]*wi + im[b]*wr;
+					re[b] = re[a] - tr; im[b] = im[a] - ti;
+					re[a] += tr; im[a] += ti;
+				}
+			}
+		}
+	}
+	
+	void build(){
+		unsigned N = mTable->size();
+		const ArrayPow2<float>& t = *mTable;
+		
+		// the table's spectrum; bin h holds harmonic h
+		std::vector<double> re(N), im(N, 0.);
+		for(unsigned i=0; i<N; ++i) re[i] = t[i];
+		fft(re, im, -1);
+		for(unsigned h=1; h<=N/2; ++h)
+			if(std::sqrt(re[h]*re[h] + im[h]*im[h]) * 2/N > 1e-6) mHighest = h;
+		
+		for(unsigned top = N/2; top >= 1; top >>= 1){
+			if(top >= mHighest){
+				mLevels.push_back(mTable);
+				continue;
+			}
+			
+			// harmonics up to top (and their mirror images) back to one cycle
+			std::vector<double> lr(N, 0.), li(N, 0.);
+			lr[0] = re[0];
+			for(unsigned h=1; h<=top; ++h){
+				lr[h] = re[h]; li[h] = im[h];
+				lr[N-h] = re[h]; li[N-h] = -im[h];
+			}
+			fft(lr, li, 1);
+			ArrayPow2<float> * level = new ArrayPow2<float>(N);
+			mOwned.push_back(std::unique_ptr<ArrayPow2<float> >(level));
+			for(unsigned i=0; i<N; ++i) (*level)[i] = float(lr[i] / N);
+			mLevels.push_back(level);
+		}
+	}
+};
+
+
+// Base for the instruments. onProcess is the per-sample path gam::Scheduler
+// drives; onBlock renders the next frames of the note into outL/outR (adding
+// to them) and is what VoiceScheduler calls. onBlock also leaves the peak of
+// what it rendered in mPeak, which VoiceScheduler culls releasing voices by.
+//
+// The block paths are templates specialized on settings that are fixed for
+// a note (a centered pan, no tremolo); the setters involved pick the variant
+// onBlock calls, so voices made by note<T>() or add<T>().set(...) get it
+// automatically.
+struct Voice : public Process<AudioIOData> {
+	enum { MAX_LAYERS = 3 };	// most notes layer() folds into one voice
+	
+	float mPeak;	// largest |sample| of the last onBlock, before panning
+	
+	Voice(): mPeak(0) {}
+	
+	virtual void onBlock(float * outL, float * outR, int frames) = 0;
+	
+	// True once the note can only get quieter
+	virtual bool releasing() const { return false; }
+	
+	// Upper bound on how long a note started at start with set(params, n)
+	// sounds (seconds), worked out without building it; time-sliced renders
+	// replay notes by it. Each instrument hides this with its own.
+	static double noteLifetime(double /*start*/, const float * /*params*/, int /*n*/){ return 1e30; }
+	
+	// Bus the instrument's notes go to unless bus(name) says otherwise; 0
+	// names it after the class
+	static const char * busName(){ return 0; }
+	
+	// Take over v, a voice of the same type that hasn't rendered yet and
+	// starts on the same frame, rendering it from this voice's oscillator.
+	// False if the two can't share one; v is then rendered on its own.
+	virtual bool layer(Voice& /*v*/){ return false; }
+};
+
+// How long an EnvFollow takes to fall below a voice's free threshold once its
+// envelopes have ended, with a wide margin
+static const double ENV_FOLLOW_TAIL = 2.;
+
+// Length of an Env<3> after totalLength(dur, 1)
+template <class E>
+inline double envLength(E& env, double dur){
+	return std::max<double>(dur, env.lengths()[0] + env.lengths()[2]);
+}
+
+
+struct SineEnv : public Voice {
     float mAmp;
     float mDur;
+    float mFreq;
+    uint32_t mPhase;
     Pan<> mPan;
     Sine<> mOsc;
     Env<3> mAmpEnv;
     
+    typedef void (SineEnv::*Render)(float *, float *, int);
+    Render mRender;		// renderBlock variant for the settings
+    
     void onProcess(AudioIOData& io){
         mAmpEnv.totalLength(mDur, 1);
         
@@ -35,8 +725,45 @@ struct SineEnv : public Process<AudioIOData> {
         if(mAmpEnv.done()) free();
     }
     
+    void onBlock(float * outL, float * outR, int frames){ (this->*mRender)(outL, outR, frames); }
+    
+    // Mono when both pan gains are equal
+    template <bool Mono>
+    void renderBlock(float * outL, float * outR, int frames){
+        mAmpEnv.totalLength(mDur, 1);
+        
+        float gainL, gainR;
+        panGains(mPan, gainL, gainR);
+        uint32_t inc = phaseInc(mFreq);
+        alignas(32) float osc[VOICE_BLOCK], env[VOICE_BLOCK];
+        
+        mPeak = 0;
+        for(int i=0; i<frames; i+=VOICE_BLOCK) {
+            int n = std::min(VOICE_BLOCK, frames - i);
+            sineBlock(osc, mPhase, inc, n);
+            envBlock(env, mAmpEnv, n);
+            for(int k=0; k<n; ++k) osc[k] = osc[k] * env[k] * mAmp;
+            mPeak = std::max(mPeak, blockPeak(osc, n));
+            panOut<Mono>(outL + i, outR + i, osc, gainL, gainR, n);
+        }
+        if(mAmpEnv.done()) free();
+    }
+    
+    void variant(){
+        float gainL, gainR;
+        panGains(mPan, gainL, gainR);
+        mRender = gainL == gainR ? &SineEnv::renderBlock<true> : &SineEnv::renderBlock<false>;
+    }
+    
+    bool releasing() const { return mAmpEnv.stage() >= 2; }
     
-    SineEnv& freq(float v){ mOsc.freq(v); return *this; }
+    static double noteLifetime(double, const float * p, int n){
+        float dur = n > 0 ? p[0] : 6.5f, attack = n > 3 ? p[3] : 1.f, decay = n > 4 ? p[4] : 2.f;
+        return std::max(dur, attack + decay);
+    }
+    
+    
+    SineEnv& freq(float v){ mOsc.freq(v); mFreq=v; return *this; }
     SineEnv& amp(float v){ mAmp=v; return *this; }
     SineEnv& attack(float v) {
         mAmpEnv.lengths()[0] = v;
@@ -47,12 +774,22 @@ struct SineEnv : public Process<AudioIOData> {
         return *this;
     }
     SineEnv& dur(float v){ mDur=v; return *this; }
-    SineEnv& pan(float v){ mPan.pos(v); return *this; }
+    SineEnv& pan(float v){ mPan.pos(v); variant(); return *this; }
     SineEnv& set(float a, float b, float c, float d, float e, float f=0) {
         return dur(a).freq(b).amp(c).attack(d).decay(e).pan(f);
     }
     
-    SineEnv(double startTime=0) {
+    // The first n arguments of set(...) from an array
+    SineEnv& set(const float * p, int n, ArrayPow2<float> * /*table*/ = 0) {
+        typedef SineEnv& (SineEnv::*Setter)(float);
+        static const Setter setters[] = {
+            &SineEnv::dur, &SineEnv::freq, &SineEnv::amp, &SineEnv::attack, &SineEnv::decay, &SineEnv::pan
+        };
+        for(int i=0; i<n; ++i) (this->*setters[i])(p[i]);
+        return *this;
+    }
+    
+    SineEnv(double startTime=0): mPhase(0), mRender(&SineEnv::renderBlock<false>) {
         set(6.5, 60, 0.3, 1, 2);
         dt(startTime);
         mAmpEnv.curve(0); // make segments lines
@@ -61,243 +798,2678 @@ struct SineEnv : public Process<AudioIOData> {
 };
 
 
-struct OscTrm : public Process<AudioIOData> {
+struct OscTrm : public Voice {
+	
+	// A note taken over by layer(...): it shares the oscillator, tremolo and
+	// pan, and keeps its own amp and envelope
+	struct Layer {
+		float amp;
+		Env<3> env;
+		EnvFollow<> follow;
+		bool ended;
+	};
+	
+	// What the block path reads every block comes first, after the Voice
+	// header; the layers (only read when there are any), the table the note
+	// was given and the per-sample path's oscillators follow.
+	typedef void (OscTrm::*Render)(float *, float *, int);
+	Render mRender;			// renderBlock variant for the settings
 	float mAmp;
 	float mDur;
 	float mTrmDepth;
+	float mFreq;
+	float mGainL, mGainR;	// mPan's
+	uint32_t mPhase, mTrmPhase;
+	ArrayPow2<float> * mTable;	// what is played: the level for mFreq
+	int mTrmRate;			// onBlock updates the tremolo rate every this many frames, 0 = every frame
+	float mTrmCurve;		// curvature of the tremolo rate sweep
+	int mNumLayers;
+	bool mEnded;			// this note's own envelope has ended, its layers may not have
+	Env<3> mAmpEnv;
+	EnvFollow<> mEnvFollow;
+	Env<2> mTrmEnv;
+	EnvCurve<2> mTrmSweep;	// mTrmEnv at control rate
+	
+	Layer mLayers[MAX_LAYERS];
+	ArrayPow2<float> * mSource;	// table the note was given
+	TableMips * mMips;			// its band-limited levels, if any
 	Sine<> mTrm;
 	Pan<> mPan;
-	Env<2> mTrmEnv;
 	Osc<> mOsc;
-	Env<3> mAmpEnv;
-	EnvFollow<> mEnvFollow;
 	
-	void onProcess(AudioIOData& io){
+	// Tremolo control rate voices start with (see trmRate)
+	static int& defaultTrmRate(){ static int k = 0; return k; }
+	
+	void onProcess(AudioIOData& io){
+		
+		mAmpEnv.totalLength(mDur, 1);
+		mTrmEnv.totalLength(mDur);
+		
+		while(io()){
+			
+			mTrm.freq(mTrmEnv());
+			//float trmAmp = mAmp - mTrm()*mTrmDepth; // Replaced with line below
+			float trmAmp = (mTrm()*0.5+0.5)*mTrmDepth + (1-mTrmDepth); // Corrected
+			float s1 = mOsc() * mAmpEnv() * trmAmp * mAmp;
+			float s2;
+			mEnvFollow(s1);
+			mPan(s1, s1,s2);
+			io.out(0) += s1;
+			io.out(1) += s2;
+		}
+		if(mAmpEnv.done() && (mEnvFollow.value() < 0.001)) free();
+	}
+	
+	void onBlock(float * outL, float * outR, int frames){ (this->*mRender)(outL, outR, frames); }
+	
+	// Tremolo is compiled out when the depth is 0; Mono when both pan gains
+	// are equal. Layers are only rendered here: the scheduler doesn't merge
+	// notes for the per-sample path.
+	template <bool Tremolo, bool Mono>
+	void renderBlock(float * outL, float * outR, int frames){
+		
+		mAmpEnv.totalLength(mDur, 1);
+		mTrmEnv.totalLength(mDur);
+		for(int l=0; l<mNumLayers; ++l) mLayers[l].env.totalLength(mDur, 1);
+		
+		float gainL = mGainL, gainR = mGainR;
+		const float * table = &(*mTable)[0];
+		int bits = log2Size(mTable->size());
+		uint32_t inc = phaseInc(mFreq);
+		alignas(32) float osc[VOICE_BLOCK], env[VOICE_BLOCK], trm[VOICE_BLOCK];
+		alignas(32) float out[VOICE_BLOCK], part[VOICE_BLOCK];
+		
+		mPeak = 0;
+		for(int i=0; i<frames; i+=VOICE_BLOCK){
+			int n = std::min(VOICE_BLOCK, frames - i);
+			
+			if(Tremolo){
+				if(mTrmRate) trmSweep(trm, n);
+				else {
+					// the tremolo rate follows its envelope, so its phase is stepped
+					// one frame at a time and only the sine is evaluated in bulk
+					uint32_t p = mTrmPhase;
+					for(int k=0; k<n; ++k){
+						trm[k] = phaseToCycle(p);
+						p += phaseInc(mTrmEnv());
+					}
+					mTrmPhase = p;
+				}
+				for(int k=0; k<n; ++k) trm[k] = (sinCycle(trm[k])*0.5f+0.5f)*mTrmDepth + (1-mTrmDepth);
+			}
+			
+			tableBlock(osc, table, bits, mPhase, inc, n);
+			if(mEnded) std::fill(out, out + n, 0.f);
+			else shape<Tremolo>(out, osc, trm, env, mAmpEnv, mEnvFollow, mAmp, n);
+			for(int l=0; l<mNumLayers; ++l){
+				Layer& layer = mLayers[l];
+				if(layer.ended) continue;
+				shape<Tremolo>(part, osc, trm, env, layer.env, layer.follow, layer.amp, n);
+				for(int k=0; k<n; ++k) out[k] += part[k];
+			}
+			mPeak = std::max(mPeak, blockPeak(out, n));
+			panOut<Mono>(outL + i, outR + i, out, gainL, gainR, n);
+		}
+		
+		// each note ends as it would on its own; the voice once all have
+		mEnded = mEnded || (mAmpEnv.done() && (mEnvFollow.value() < 0.001));
+		bool ended = mEnded;
+		for(int l=0; l<mNumLayers; ++l){
+			Layer& layer = mLayers[l];
+			layer.ended = layer.ended || (layer.env.done() && (layer.follow.value() < 0.001));
+			ended = ended && layer.ended;
+		}
+		if(ended) free();
+	}
+	
+	// One note's share of the oscillator: osc through its envelope, tremolo
+	// and amp into out
+	template <bool Tremolo>
+	static void shape(float * out, const float * osc, const float * trm, float * env,
+		Env<3>& ampEnv, EnvFollow<>& follow, float amp, int n
+	){
+		envBlock(env, ampEnv, n);
+		if(Tremolo) for(int k=0; k<n; ++k) out[k] = osc[k] * env[k] * trm[k] * amp;
+		else		for(int k=0; k<n; ++k) out[k] = osc[k] * env[k] * amp;
+		for(int k=0; k<n; ++k) follow(out[k]);
+	}
+	
+	// Tremolo phases (in cycles) for n frames, holding the rate for mTrmRate
+	// frames at a time at its value halfway through
+	void trmSweep(float * trm, int n){
+		mTrmSweep.shape(mTrmEnv, mTrmCurve);
+		uint32_t p = mTrmPhase;
+		for(int i=0; i<n; i+=mTrmRate){
+			int m = std::min(mTrmRate, n - i);
+			uint32_t inc = phaseInc(mTrmSweep.value(mTrmSweep.mPos + i + 0.5*m));
+			for(int k=0; k<m; ++k) trm[i+k] = phaseToCycle(p + uint32_t(k)*inc);
+			p += uint32_t(m)*inc;
+		}
+		mTrmPhase = p;
+		mTrmSweep.mPos += n;
+	}
+	
+	void variant(){
+		panGains(mPan, mGainL, mGainR);
+		bool mono = mGainL == mGainR;
+		if(mTrmDepth != 0) mRender = mono ? &OscTrm::renderBlock<true, true>  : &OscTrm::renderBlock<true, false>;
+		else			   mRender = mono ? &OscTrm::renderBlock<false, true> : &OscTrm::renderBlock<false, false>;
+	}
+	
+	bool releasing() const {
+		bool r = mEnded || mAmpEnv.stage() >= 2;
+		for(int l=0; l<mNumLayers; ++l) r = r && (mLayers[l].ended || mLayers[l].env.stage() >= 2);
+		return r;
+	}
+	
+	// A layer's note has a lifetime of its own (see VoiceScheduler::recordSegments)
+	static double noteLifetime(double, const float * p, int n){
+		float dur = n > 0 ? p[0] : 10.f, attack = n > 3 ? p[3] : 0.1f, decay = n > 4 ? p[4] : 2.f;
+		return std::max(dur, attack + decay) + ENV_FOLLOW_TAIL;
+	}
+	
+	// Notes of the same pitch, table, length, tremolo and pan share one
+	// oscillator; their amps and envelopes may differ
+	bool layer(Voice& v){
+		OscTrm& o = static_cast<OscTrm&>(v);
+		if(mNumLayers == MAX_LAYERS || o.mNumLayers) return false;
+		if(o.mFreq != mFreq || o.mTable != mTable || o.mDur != mDur || o.mRender != mRender) return false;
+		if(o.mPhase != mPhase || o.mTrmPhase != mTrmPhase) return false;
+		if(o.mTrmDepth != mTrmDepth || o.mTrmCurve != mTrmCurve || o.mTrmRate != mTrmRate) return false;
+		for(int i=0; i<3; ++i) if(o.mTrmEnv.levels()[i] != mTrmEnv.levels()[i]) return false;
+		for(int i=0; i<2; ++i) if(o.mTrmEnv.lengths()[i] != mTrmEnv.lengths()[i]) return false;
+		if(o.mGainL != mGainL || o.mGainR != mGainR) return false;
+		
+		Layer& layer = mLayers[mNumLayers++];
+		layer.amp = o.mAmp;
+		layer.env = o.mAmpEnv;
+		layer.follow = o.mEnvFollow;
+		layer.ended = false;
+		return true;
+	}
+	
+	// Frames between tremolo rate updates on the block path (0 = every
+	// frame); set before the note starts
+	OscTrm& trmRate(int v){ mTrmRate = std::max(v, 0); return *this; }
+	
+	OscTrm& freq(float v){ mOsc.freq(v); mFreq=v; return source(); }
+	OscTrm& amp(float v){ mAmp=v; return *this; }
+	OscTrm& dur(float v){ mDur=v; return *this; }
+	OscTrm& attack(float v){ mAmpEnv.lengths()[0]=v; return *this; }
+	OscTrm& decay(float v){  mAmpEnv.lengths()[2]=v; return *this; }
+	OscTrm& sus(float v){ mAmpEnv.levels()[2]=v; return *this; }
+	
+	OscTrm& trm1(float v){ mTrmEnv.levels(v, mTrmEnv.levels()[1], v); return *this; }
+	OscTrm& trm2(float v){ mTrmEnv.levels()[1]=v; return *this; }
+	OscTrm& trmDepth(float v){ mTrmDepth=v; variant(); return *this; }
+	OscTrm& trmRise(float v){ mTrmEnv.lengths(v,1-v); return *this; }
+	
+	OscTrm& table(ArrayPow2<float>& v){ mSource=&v; mMips=TableMips::find(v); return source(); }
+	
+	// Play the level of the table that doesn't alias at mFreq
+	OscTrm& source(){
+		mTable = mMips ? &mMips->forFreq(mFreq) : mSource;
+		mOsc.source(*mTable);
+		return *this;
+	}
+	
+	OscTrm& pan(float v){ mPan.pos(v); variant(); return *this; }
+	
+	
+	OscTrm& set(
+				float a, float b, float c, float d, float e, float f,
+				float g, float h, float i, float j,
+				ArrayPow2<float>& k, float l
+				){
+		return dur(a).freq(b).amp(c).attack(d).decay(e).sus(f)
+		.trmDepth(g).trm1(h).trm2(i).trmRise(j)
+		.table(k).pan(l);
+	}
+	
+	// The set(...) arguments from an array, without the table
+	OscTrm& set(const float * p, int n, ArrayPow2<float> * table=0){
+		typedef OscTrm& (OscTrm::*Setter)(float);
+		static const Setter setters[] = {
+			&OscTrm::dur, &OscTrm::freq, &OscTrm::amp, &OscTrm::attack, &OscTrm::decay, &OscTrm::sus,
+			&OscTrm::trmDepth, &OscTrm::trm1, &OscTrm::trm2, &OscTrm::trmRise, &OscTrm::pan
+		};
+		for(int i=0; i<n; ++i) (this->*setters[i])(p[i]);
+		if(table) this->table(*table);
+		return *this;
+	}
+	
+	OscTrm(double startTime=0)
+	:	mRender(&OscTrm::renderBlock<true, false>), mAmp(1), mDur(2), mFreq(262), mGainL(1), mGainR(1),
+		mPhase(0), mTrmPhase(0), mTrmRate(defaultTrmRate()), mTrmCurve(-4), mNumLayers(0), mEnded(false),
+		mSource(&mOsc), mMips(0)
+	{
+		mTrmEnv.curve(mTrmCurve); // Gamma's default, spelled out for mTrmSweep
+		dt(startTime);
+		set(10, 262, 0.5, 0.1,2,0.8, 0.4,4,8,0.5, mOsc, 0.8);
+		mAmpEnv.levels(0,1,1,0);
+	}
+	
+};
+
+
+struct AddSyn : public Voice {
+    
+	enum { STRI, LOW, UP };	// partial groups, each with its own envelope
+	enum { NUM_PARAMS = 24 };
+	
+	// The arguments to set(...) a plain AddSyn starts with
+	static const float * defaults() {
+		static const float p[] = {6.2,155.6,0.01,0.5,0.1,0.1,0.8,0.5,0.001,0.1,0.8,0.6,0.01,0.075,0.9,1,2.001,3,4.00009,5.0002,6,7,8,9};
+		//static const float p[] = {6.2,155.6,0.01,0.5,0.01,0.01,0.8,0.5,0.001,0.1,0.8,0.6,0.01,0.075,0.9,1,2.001,3,4.00009,5.0002,6,7,8,9};
+		return p;
+	}
+	
+	// What the block path reads every block comes first, after the Voice
+	// header, so rendering a voice walks a few adjacent cache lines; the
+	// settings and the per-sample path's oscillators follow.
+	typedef void (AddSyn::*Render)(float *, float *, int);
+	Render mRender;			// renderBlock variant for the settings
+	float mAmp;
+	float mAmpStri;
+	float mAmpLow;
+	float mAmpUp;
+	float mGainL, mGainR;	// mPan's
+	int mControlRate;		// onBlock evaluates the envelopes every this many frames, 0 = every frame
+	PartialBank<9> mPartials;	// stri 0-2, low 3-4, up 5-8
+	EnvFollow<> mEnvFollow;
+	Env<3> mEnvStri;
+	Env<3> mEnvLow;
+	Env<3> mEnvUp;
+	EnvCurve<3> mCurveStri, mCurveLow, mCurveUp;	// the envelopes at control rate
+	
+	float mDur;
+	float mOscFrq;
+	float mCurve;			// curvature of the three envelopes
+	Pan<> mPan;
+	Sine<> mOsc[9];			// onProcess's partials, as mPartials'
+	
+	// Control rate voices start with (see controlRate)
+	static int& defaultControlRate(){ static int k = 0; return k; }
+	
+	void onProcess(AudioIOData& io){
+		
+		mEnvStri.totalLength(mDur, 1);
+		mEnvLow.totalLength(mDur, 1);
+		mEnvUp.totalLength(mDur, 1);
+		
+		while(io()){
+			float s1 = (mOsc[0]() + mOsc[1]() + mOsc[2]()) * mEnvStri() * mAmpStri;
+			s1 += (mOsc[3]() + mOsc[4]()) * mEnvLow() * mAmpLow;
+			s1 += (mOsc[5]() + mOsc[6]() + mOsc[7]() + mOsc[8]()) * mEnvUp() * mAmpUp;
+			s1 *= mAmp;
+			float s2;
+			mEnvFollow(s1);
+			mPan(s1, s1,s2);
+			io.out(0) += s1;
+			io.out(1) += s2;
+		}
+		if(mEnvStri.done() && (mEnvFollow.value() < 0.0001)) free();
+	}
+	
+	void onBlock(float * outL, float * outR, int frames){ (this->*mRender)(outL, outR, frames); }
+	
+	// Mono when both pan gains are equal
+	template <bool Mono>
+	void renderBlock(float * outL, float * outR, int frames){
+		
+		prepare();
+		
+		float gainL = mGainL, gainR = mGainR;
+		alignas(32) float stri[VOICE_BLOCK], low[VOICE_BLOCK], up[VOICE_BLOCK];
+		alignas(32) float envStri[VOICE_BLOCK], envLow[VOICE_BLOCK], envUp[VOICE_BLOCK];
+		float * groups[3] = { stri, low, up };
+		long long rendered = 0, skipped = 0;
+		
+		mPeak = 0;
+		for(int i=0; i<frames; i+=VOICE_BLOCK){
+			int n = std::min(VOICE_BLOCK, frames - i);
+			
+			// the envelopes first, to leave out the partials they make inaudible
+			envelope(envStri, STRI, n);
+			envelope(envLow, LOW, n);
+			envelope(envUp, UP, n);
+			float peak[3] = {
+				blockPeak(envStri, n) * std::fabs(mAmpStri * mAmp),
+				blockPeak(envLow, n) * std::fabs(mAmpLow * mAmp),
+				blockPeak(envUp, n) * std::fabs(mAmpUp * mAmp)
+			};
+			bool live[9];
+			int count = mPartials.audible(peak, live);
+			rendered += count * n;
+			skipped += (mPartials.size() - count) * n;
+			mPartials.render(groups, n, live);
+			
+			for(int k=0; k<n; ++k) stri[k] = stri[k] * envStri[k] * mAmpStri;
+			for(int k=0; k<n; ++k) stri[k] += low[k] * envLow[k] * mAmpLow;
+			for(int k=0; k<n; ++k) stri[k] += up[k] * envUp[k] * mAmpUp;
+			for(int k=0; k<n; ++k) stri[k] *= mAmp;
+			
+			for(int k=0; k<n; ++k) mEnvFollow(stri[k]);
+			mPeak = std::max(mPeak, blockPeak(stri, n));
+			panOut<Mono>(outL + i, outR + i, stri, gainL, gainR, n);
+		}
+		PartialLod::count(rendered, skipped);
+		bool envDone = mControlRate ? mCurveStri.done() : mEnvStri.done();
+		if(envDone && (mEnvFollow.value() < 0.0001)) free();
+	}
+	
+	// Apply the settings to the block path's state: envelope lengths,
+	// partial increments and the control rate curves. Done every block, as
+	// onProcess does, so setters called while the note plays take effect.
+	void prepare(){
+		mEnvStri.totalLength(mDur, 1);
+		mEnvLow.totalLength(mDur, 1);
+		mEnvUp.totalLength(mDur, 1);
+		mPartials.tune(mOscFrq);
+		if(mControlRate){
+			mCurveStri.shape(mEnvStri, mCurve);
+			mCurveLow.shape(mEnvLow, mCurve);
+			mCurveUp.shape(mEnvUp, mCurve);
+		}
+	}
+	
+	// The next n frames of a group's envelope, at audio or control rate
+	void envelope(float * out, int group, int n){
+		if(mControlRate){
+			EnvCurve<3>& c = group == STRI ? mCurveStri : group == LOW ? mCurveLow : mCurveUp;
+			c.render(out, n, mControlRate);
+		}
+		else envBlock(out, group == STRI ? mEnvStri : group == LOW ? mEnvLow : mEnvUp, n);
+	}
+	
+	void variant(){
+		panGains(mPan, mGainL, mGainR);
+		mRender = mGainL == mGainR ? &AddSyn::renderBlock<true> : &AddSyn::renderBlock<false>;
+	}
+	
+	static double noteLifetime(double, const float * p, int n){ return envLifetime(defaults(), p, n); }
+	
+	// Lifetime of a note whose set(...) arguments are the first n of p and
+	// then defs, the instrument's defaults()
+	static double envLifetime(const float * defs, const float * p, int n){
+		float dur = n > 0 ? p[0] : defs[0];
+		double env = 0;
+		for(int e=0; e<3; ++e){
+			int a = 4 + 4*e, d = 5 + 4*e;	// attack and decay of STRI, LOW, UP
+			env = std::max(env, std::max<double>(dur, (n > a ? p[a] : defs[a]) + (n > d ? p[d] : defs[d])));
+		}
+		return env + ENV_FOLLOW_TAIL;
+	}
+	
+	bool releasing() const {
+		if(mControlRate)
+			return mCurveStri.stage() >= 2 && mCurveLow.stage() >= 2 && mCurveUp.stage() >= 2;
+		return mEnvStri.stage() >= 2 && mEnvLow.stage() >= 2 && mEnvUp.stage() >= 2;
+	}
+	
+	AddSyn& freq(float v){
+		mOscFrq=v;
+		for(int j=0; j<9; ++j) mOsc[j].freq(mPartials.ratio(j)*mOscFrq);
+		return *this;
+	}
+	
+	// Frames between envelope evaluations on the block path (0 = every frame);
+	// set before the note starts
+	AddSyn& controlRate(int v){ mControlRate = std::max(v, 0); return *this; }
+	
+	AddSyn& freqStri1(float v){ mPartials.ratio(0, v); mOsc[0].freq(v*mOscFrq); return *this; }
+	AddSyn& freqStri2(float v){ mPartials.ratio(1, v); mOsc[1].freq(v*mOscFrq); return *this; }
+	AddSyn& freqStri3(float v){ mPartials.ratio(2, v); mOsc[2].freq(v*mOscFrq); return *this; }
+	AddSyn& freqLow1(float v){ mPartials.ratio(3, v); mOsc[3].freq(v*mOscFrq); return *this; }
+	AddSyn& freqLow2(float v){ mPartials.ratio(4, v); mOsc[4].freq(v*mOscFrq); return *this; }
+	AddSyn& freqUp1(float v){ mPartials.ratio(5, v); mOsc[5].freq(v*mOscFrq); return *this; }
+	AddSyn& freqUp2(float v){ mPartials.ratio(6, v); mOsc[6].freq(v*mOscFrq); return *this; }
+	AddSyn& freqUp3(float v){ mPartials.ratio(7, v); mOsc[7].freq(v*mOscFrq); return *this; }
+	AddSyn& freqUp4(float v){ mPartials.ratio(8, v); mOsc[8].freq(v*mOscFrq); return *this; }
+	AddSyn& freqUp(float v1, float v2, float v3, float v4) {
+		return freqUp1(v1).freqUp2(v2).freqUp3(v3).freqUp4(v4);
+	}
+	
+	AddSyn& freq(float v1, float v2) {
+		dur(v1);
+		freq(v2);
+		return *this;
+	}
+	
+	AddSyn& amp(float v){ mAmp=v; return *this; }
+	AddSyn& ampStri(float v){ mAmpStri=v; return *this; }
+	AddSyn& attackStri(float v){ mEnvStri.lengths()[0] = v; return *this; }
+	AddSyn& decayStri(float v){ mEnvStri.lengths()[2] = v; return *this; }
+	AddSyn& susStri(float v){ mEnvStri.levels()[2]=v; return *this; }
+	AddSyn& ampLow(float v){ mAmpLow=v; return *this; }
+	AddSyn& attackLow(float v){ mEnvLow.lengths()[0] = v; return *this; }
+	AddSyn& decayLow(float v){ mEnvLow.lengths()[2] = v; return *this; }
+	AddSyn& susLow(float v){ mEnvLow.levels()[2]=v; return *this; }
+	AddSyn& ampUp(float v){ mAmpUp=v; return *this; }
+	AddSyn& attackUp(float v){ mEnvUp.lengths()[0] = v; return *this; }
+	AddSyn& decayUp(float v){ mEnvUp.lengths()[2] = v; return *this; }
+	AddSyn& susUp(float v){ mEnvUp.levels()[2]=v; return *this; }
+	
+	
+	AddSyn& dur(float v){ mDur=v; return *this; }
+	
+	AddSyn& pan(float v){ mPan.pos(v); variant(); return *this; }
+	
+	AddSyn& set(
+				float a, float b, float c, float d, float e,float f, float g, float h, float i, float j,
+				float k, float l, float m, float n, float o, float p, float q, float r, float s, float t,
+				float u, float v, float w, float x, float y=0
+				){
+		return dur(a).freq(b).amp(c).ampStri(d).attackStri(e).decayStri(f).susStri(g).ampLow(h)
+		.attackLow(i).decayLow(j).susLow(k).ampUp(l).attackUp(m).decayUp(n).susUp(o)
+		.freqStri1(p).freqStri2(q).freqStri3(r).freqLow1(s).freqLow2(t).freqUp1(u)
+		.freqUp2(v).freqUp3(w).freqUp4(x).pan(y);
+	}
+	
+	// The first n arguments of set(...) from an array
+	AddSyn& set(const float * p, int n, ArrayPow2<float> * /*table*/ = 0){
+		typedef AddSyn& (AddSyn::*Setter)(float);
+		static const Setter setters[] = {
+			&AddSyn::dur, &AddSyn::freq, &AddSyn::amp, &AddSyn::ampStri, &AddSyn::attackStri,
+			&AddSyn::decayStri, &AddSyn::susStri, &AddSyn::ampLow, &AddSyn::attackLow, &AddSyn::decayLow,
+			&AddSyn::susLow, &AddSyn::ampUp, &AddSyn::attackUp, &AddSyn::decayUp, &AddSyn::susUp,
+			&AddSyn::freqStri1, &AddSyn::freqStri2, &AddSyn::freqStri3, &AddSyn::freqLow1, &AddSyn::freqLow2,
+			&AddSyn::freqUp1, &AddSyn::freqUp2, &AddSyn::freqUp3, &AddSyn::freqUp4, &AddSyn::pan
+		};
+		for(int i=0; i<n; ++i) (this->*setters[i])(p[i]);
+		return *this;
+	}
+	
+    AddSyn(double startTime=0)
+	:	mRender(&AddSyn::renderBlock<false>), mGainL(1), mGainR(1), mControlRate(defaultControlRate()),
+		mOscFrq(0), mCurve(-4)
+	{
+		mPartials.add(1, STRI); mPartials.add(2, STRI); mPartials.add(3, STRI);
+		mPartials.add(4, LOW); mPartials.add(5, LOW);
+		mPartials.add(6, UP); mPartials.add(7, UP); mPartials.add(8, UP); mPartials.add(9, UP);
+		dt(startTime);
+		set(defaults(), NUM_PARAMS).pan(0);
+		mEnvStri.curve(mCurve); // make segments lines
+		mEnvStri.levels(0,1,1,0);
+		mEnvLow.curve(mCurve); // make segments lines
+		mEnvLow.levels(0,1,1,0);
+		mEnvUp.curve(mCurve); // make segments lines
+		mEnvUp.levels(0,1,1,0);
+	}
+	
+};
+
+struct Chimes : public AddSyn {
+    
+	enum { NUM_PARAMS = 24 };
+	
+	// Chimes' arguments to AddSyn::set(...)
+	static const float * defaults() {
+		//static const float p[] = {6.2,440,0.1,0.5,0.0001,3.8,0.3,0.4,0.0001,6.0,0.99,0.3,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36};
+		static const float p[] = {6.2,440,0.1,0.05,0.0001,3.8,0.3,0.04,0.0001,6.0,0.99,0.03,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36};
+		return p;
+	}
+	
+	static double noteLifetime(double, const float * p, int n){ return envLifetime(defaults(), p, n); }
+	
+	Chimes(double startTime=0) :AddSyn(startTime) {
+		set (defaults(), NUM_PARAMS);
+	}
+};
+
+
+struct Trumpet : public AddSyn {
+    
+	enum { NUM_PARAMS = 24 };
+	
+	// Trumpet's arguments to AddSyn::set(...)
+	static const float * defaults() {
+		//static const float p[] = {6.2,440,0.1,0.5,0.0001,3.8,0.3,0.4,0.0001,6.0,0.99,0.3,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36};
+		static const float p[] = {6.2,440,0.5,0.05,0.0001,3.8,0.3,0.04,0.0001,6.0,0.99,0.03,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36};
+		return p;
+	}
+	
+	static double noteLifetime(double, const float * p, int n){ return envLifetime(defaults(), p, n); }
+	
+	Trumpet(double startTime=0) :AddSyn(startTime) {
+		set (defaults(), NUM_PARAMS);
+	}
+};
+
+
+// AddSyn rendered by a SpectralBank instead of a PartialBank: the same
+// setters and set(...) arguments (so Chimes' and Trumpet's defaults() work
+// as they are), and any number of partials past the nine up to
+// MAX_PARTIALS, for about the same cost. Envelopes are evaluated at the
+// frame centers, every SpectralBank::HOP frames.
+struct AddSynFFT : public AddSyn {
+	
+	enum { MAX_PARTIALS = 256 };
+	
+	SpectralBank<MAX_PARTIALS> mBank;	// AddSyn's nine partials first
+	long long mPos;						// frames rendered
+	
+	// The per-sample path renders through onBlock too
+	void onProcess(AudioIOData& io){
+		int from = io.frame() + 1;
+		onBlock(io.outBuffer(0) + from, io.outBuffer(1) + from, int(io.framesPerBuffer()) - from);
+		io.frame(io.framesPerBuffer());
+	}
+	
+	void onBlock(float * outL, float * outR, int frames){
+		mEnvStri.totalLength(mDur, 1);
+		mEnvLow.totalLength(mDur, 1);
+		mEnvUp.totalLength(mDur, 1);
+		mCurveStri.shape(mEnvStri, mCurve);
+		mCurveLow.shape(mEnvLow, mCurve);
+		mCurveUp.shape(mEnvUp, mCurve);
+		for(int j=0; j<mPartials.size(); ++j) mBank.ratio(j, mPartials.ratio(j));
+		mBank.tune(mOscFrq);
+		
+		float gainL, gainR;
+		panGains(mPan, gainL, gainR);
+		alignas(32) float out[VOICE_BLOCK];
+		long long rendered = 0, skipped = 0;
+		const int hop = SpectralBank<MAX_PARTIALS>::HOP;
+		
+		mPeak = 0;
+		for(int i=0; i<frames; i+=VOICE_BLOCK){
+			int n = std::min(VOICE_BLOCK, frames - i);
+			for(int k=0; k<n;){
+				if(mBank.needFrame()){
+					double t = double(mBank.frameTime());
+					float g[3] = {
+						mCurveStri.value(t) * mAmpStri * mAmp,
+						mCurveLow.value(t) * mAmpLow * mAmp,
+						mCurveUp.value(t) * mAmpUp * mAmp
+					};
+					int count = mBank.frame(g);
+					rendered += count * hop;
+					skipped += (mBank.size() - count) * hop;
+				}
+				k += mBank.read(out + k, n - k);
+			}
+			mPeak = std::max(mPeak, blockPeak(out, n));
+			if(gainL == gainR) panOut<true>(outL + i, outR + i, out, gainL, gainR, n);
+			else panOut<false>(outL + i, outR + i, out, gainL, gainR, n);
+		}
+		
+		PartialLod::count(rendered, skipped);
+		
+		// the last frame's second half has been played once the envelopes
+		// are past their end by a hop
+		mPos += frames;
+		mCurveStri.mPos = mCurveLow.mPos = mCurveUp.mPos = double(mPos);
+		double tail = double(mPos - SpectralBank<MAX_PARTIALS>::HOP);
+		if(mCurveStri.stage(tail) == 3 && mCurveLow.stage(tail) == 3 && mCurveUp.stage(tail) == 3) free();
+	}
+	
+	bool releasing() const {
+		return mCurveStri.stage() >= 2 && mCurveLow.stage() >= 2 && mCurveUp.stage() >= 2;
+	}
+	
+	// Add a partial at ratio times the fundamental to a group (AddSyn::STRI,
+	// LOW or UP), amp relative to the group's; ignored past MAX_PARTIALS
+	AddSynFFT& partial(float ratio, int group, float amp=1){
+		mBank.add(ratio, group, amp);
+		return *this;
+	}
+	
+	AddSynFFT(double startTime=0): AddSyn(startTime), mPos(0) {
+		for(int j=0; j<mPartials.size(); ++j) mBank.add(mPartials.ratio(j), mPartials.mGroup[j]);
+	}
+};
+
+
+// ************************************************************************
+// ChimeCloud
+//
+// A cloud of Chimes grains rendered as one voice. The fill helpers used to
+// schedule each grain as its own Chimes, hundreds of them sounding at once;
+// here every sounding grain keeps the phase and rotation of its nine
+// partials, and at the start of each block the ones worth rendering (see
+// PartialLod) are gathered into one flat table of lanes (current value,
+// rotation, gain and gain step). Each frame is a single pass over the lanes
+// that the compiler vectorizes.
+// Partials are complex rotations rather than polynomial sines, re-seeded
+// from their exact 32-bit phases at the start of every block so rounding
+// can't build up. The grain envelopes are evaluated every CONTROL_RATE
+// frames (and more often over short segments, see EnvCurve::step) and ramped
+// in between.
+//
+// Grains share everything but their start, frequency and string attack, so
+// set(...) takes Chimes' arguments followed by (start, freq, attackStri) for
+// each grain, the start in seconds like the cloud's own. set(...) sizes the
+// tables for the most grains that overlap, so rendering doesn't allocate.
+
+struct ChimeCloud : public Voice {
+	
+	enum { CONTROL_RATE = 16, PARTIALS = 9, GRAIN_PARAMS = 3, MAX_GRAINS = 4096, LANES = 8 };
+	enum { RETIRE_SLACK = 1024 };	// frames a grain may outlast its envelopes (until the end of an onBlock)
+	
+	struct Grain {
+		long long start;		// frame, counted from the cloud's start
+		float freq;
+		EnvCurve<3> env[3];		// AddSyn::STRI, LOW, UP
+		float envAt[3];			// their values at the current position
+	};
+	
+	double mStart;
+	long long mPos;				// frames rendered
+	long long mEnd;				// frame every grain has ended by
+	float mCurve;
+	float mGroupAmp[3];			// group amp times the cloud's amp
+	float mRatio[PARTIALS];
+	int mGroup[PARTIALS];
+	Pan<> mPan;
+	bool mReleasing;
+	std::vector<Grain> mGrains;		// by start
+	unsigned mNext;					// first grain that hasn't started
+	std::vector<unsigned> mActive;	// sounding grains; slot s owns partials [s*PARTIALS, (s+1)*PARTIALS)
+	
+	// per partial
+	std::vector<uint32_t> mPhase, mInc;
+	std::vector<float> mCos, mSin;
+	
+	// per lane, the partials rendered in this block, padded to a multiple of
+	// LANES with silent ones
+	int mLanes;
+	std::vector<unsigned> mLaneGroup;	// slot*3 + group, into mSlotGain
+	std::vector<float> mRe, mIm, mLaneCos, mLaneSin, mGain, mStep;
+	
+	std::vector<float> mSlotGain, mSlotStep;	// per slot and group, for the span being ramped
+	long long mRendered, mSkipped;				// partial-samples, for PartialLod
+	
+	// The per-sample path renders through onBlock too
+	void onProcess(AudioIOData& io){
+		int from = io.frame() + 1;
+		onBlock(io.outBuffer(0) + from, io.outBuffer(1) + from, int(io.framesPerBuffer()) - from);
+		io.frame(io.framesPerBuffer());
+	}
+	
+	void onBlock(float * outL, float * outR, int frames){
+		float gainL, gainR;
+		panGains(mPan, gainL, gainR);
+		alignas(32) float mono[VOICE_BLOCK];
+		
+		mPeak = 0;
+		for(int i=0; i<frames; i+=VOICE_BLOCK){
+			int n = std::min(VOICE_BLOCK, frames - i);
+			renderGrains(mono, n);
+			mPeak = std::max(mPeak, blockPeak(mono, n));
+			if(gainL == gainR) panOut<true>(outL + i, outR + i, mono, gainL, gainR, n);
+			else panOut<false>(outL + i, outR + i, mono, gainL, gainR, n);
+		}
+		PartialLod::count(mRendered, mSkipped);
+		mRendered = mSkipped = 0;
+		
+		// retire grains whose envelopes have all ended
+		mReleasing = mNext == mGrains.size();
+		for(unsigned s=0; s<mActive.size();){
+			const Grain& g = mGrains[mActive[s]];
+			double pos = double(mPos - g.start);
+			int stage = std::min(g.env[0].stage(pos), std::min(g.env[1].stage(pos), g.env[2].stage(pos)));
+			if(stage == 3){
+				retire(s);
+				continue;
+			}
+			if(stage < 2) mReleasing = false;
+			++s;
+		}
+		if(mNext == mGrains.size() && mActive.empty()) free();
+	}
+	
+	bool releasing() const { return mReleasing; }
+	
+	// A fill is the Chimes part, however it is rendered
+	static const char * busName(){ return "Chimes"; }
+	
+	// Where the last grain's envelopes end, as set(...) works it out
+	static double noteLifetime(double start, const float * p, int n){
+		float head[Chimes::NUM_PARAMS];
+		headOf(head, p, n);
+		Env<3> env[3];
+		envelopes(env, head);
+		double fps = Sync::master().spu();
+		long long first = (long long)(start * fps + 0.5), end = 0;
+		Grain g;
+		for(int i=Chimes::NUM_PARAMS; i+GRAIN_PARAMS <= n; i+=GRAIN_PARAMS)
+			end = std::max(end, shapeGrain(g, env, p + i, head[0], -4, first, fps));
+		return double(end) / fps;
+	}
+	
+	ChimeCloud& pan(float v){ mPan.pos(v); return *this; }
+	
+	// Chimes' arguments to AddSyn::set(...) (freq and attackStri are ignored),
+	// then GRAIN_PARAMS per grain
+	ChimeCloud& set(const float * p, int n, ArrayPow2<float> * /*table*/ = 0){
+		float head[Chimes::NUM_PARAMS];
+		headOf(head, p, n);
+		float dur = head[0], amp = head[2];
+		mGroupAmp[AddSyn::STRI] = head[3] * amp;
+		mGroupAmp[AddSyn::LOW] = head[7] * amp;
+		mGroupAmp[AddSyn::UP] = head[11] * amp;
+		for(int j=0; j<PARTIALS; ++j) mRatio[j] = head[15 + j];
+		
+		Env<3> env[3];
+		envelopes(env, head);
+		double fps = Sync::master().spu();
+		long long first = (long long)(mStart * fps + 0.5);
+		mGrains.clear();
+		mEnd = 0;
+		std::vector<std::pair<long long, int> > edges;	// +1 where a grain starts, -1 once it is retired
+		for(int i=Chimes::NUM_PARAMS; i+GRAIN_PARAMS <= n; i+=GRAIN_PARAMS){
+			Grain g;
+			long long end = shapeGrain(g, env, p + i, dur, mCurve, first, fps);
+			mEnd = std::max(mEnd, end);
+			mGrains.push_back(g);
+			edges.push_back(std::make_pair(g.start, 1));
+			edges.push_back(std::make_pair(end + RETIRE_SLACK, -1));
+		}
+		std::stable_sort(mGrains.begin(), mGrains.end(), earlier);
+		
+		// size the tables for the most grains sounding at once, so rendering
+		// doesn't allocate
+		std::sort(edges.begin(), edges.end());
+		int sounding = 0, most = 0;
+		for(unsigned i=0; i<edges.size(); ++i) most = std::max(most, sounding += edges[i].second);
+		size_t size = size_t(most) * PARTIALS;
+		mActive.reserve(most);
+		mPhase.assign(size, 0); mInc.assign(size, 0);
+		mCos.assign(size, 0.f); mSin.assign(size, 0.f);
+		mSlotGain.assign(most * 3, 0.f);
+		mSlotStep.assign(most * 3, 0.f);
+		size = (size + LANES-1) / LANES * LANES;
+		mLaneGroup.assign(size, 0);
+		mRe.assign(size, 0.f); mIm.assign(size, 0.f);
+		mLaneCos.assign(size, 0.f); mLaneSin.assign(size, 0.f);
+		mGain.assign(size, 0.f); mStep.assign(size, 0.f);
+		return *this;
+	}
+	
+	ChimeCloud(double startTime=0)
+	:	mStart(startTime), mPos(0), mEnd(0), mCurve(-4), mReleasing(false), mNext(0),
+		mLanes(0), mRendered(0), mSkipped(0)
+	{
+		dt(startTime);
+		for(int j=0; j<PARTIALS; ++j) mGroup[j] = j < 3 ? AddSyn::STRI : j < 5 ? AddSyn::LOW : AddSyn::UP;
+		for(int e=0; e<3; ++e) mGroupAmp[e] = 0;
+		for(int j=0; j<PARTIALS; ++j) mRatio[j] = 0;
+	}
+	
+private:
+	static bool earlier(const Grain& a, const Grain& b){ return a.start < b.start; }
+	
+	// The first n arguments from p, the rest of Chimes' from its defaults()
+	static void headOf(float * head, const float * p, int n){
+		std::copy(Chimes::defaults(), Chimes::defaults() + Chimes::NUM_PARAMS, head);
+		std::copy(p, p + std::min<int>(n, Chimes::NUM_PARAMS), head);
+	}
+	
+	// The envelopes as AddSyn sets them up from those arguments
+	static void envelopes(Env<3> * env, const float * head){
+		for(int e=0; e<3; ++e){
+			env[e].levels(0, 1, head[6 + 4*e], 0);
+			env[e].lengths()[0] = head[4 + 4*e];
+			env[e].lengths()[2] = head[5 + 4*e];
+		}
+	}
+	
+	// Set g up from its GRAIN_PARAMS arguments at p (env gets its attack);
+	// returns the frame its envelopes have all ended by
+	static long long shapeGrain(Grain& g, Env<3> * env, const float * p, float dur, float curve,
+		long long first, double fps
+	){
+		g.start = (long long)(double(p[0]) * fps + 0.5) - first;
+		g.freq = p[1];
+		env[AddSyn::STRI].lengths()[0] = p[2];
+		long long end = 0;
+		for(int e=0; e<3; ++e){
+			env[e].totalLength(dur, 1);
+			g.env[e].shape(env[e], curve);
+			g.envAt[e] = 0;
+			float len = g.env[e].mLen[0] + g.env[e].mLen[1] + g.env[e].mLen[2];
+			end = std::max(end, g.start + (long long)std::ceil(len));
+		}
+		return end;
+	}
+	
+	void renderGrains(float * out, int n){
+		mLanes = 0;
+		for(unsigned s=0; s<mActive.size(); ++s) lanes(s, 0, n);
+		
+		for(int t=0; t<n;){
+			while(mNext < mGrains.size() && mGrains[mNext].start <= mPos + t) start(mNext++, t, n);
+			
+			// up to the next grain, and no longer than any envelope allows
+			int m = n - t;
+			if(mNext < mGrains.size()) m = int(std::min<long long>(m, mGrains[mNext].start - (mPos + t)));
+			for(unsigned s=0; s<mActive.size(); ++s){
+				const Grain& g = mGrains[mActive[s]];
+				double pos = double(mPos + t - g.start);
+				for(int e=0; e<3; ++e) m = std::min(m, g.env[e].step(pos, CONTROL_RATE));
+			}
+			
+			ramp(t, m);
+			rotate(out + t, m);
+			t += m;
+		}
+		
+		int size = int(mActive.size()) * PARTIALS;
+		for(int k=0; k<size; ++k) mPhase[k] += mInc[k] * uint32_t(n);
+		mPos += n;
+	}
+	
+	// Give slot s's partials that are audible from t to the end of the
+	// n-frame block lanes, with exact values from their phases
+	void lanes(unsigned s, int t, int n){
+		const Grain& g = mGrains[mActive[s]];
+		double pos = double(mPos + t - g.start);
+		float peak[3], level = 0.f;
+		for(int e=0; e<3; ++e){
+			peak[e] = g.env[e].peak(pos, n - t) * std::fabs(mGroupAmp[e]);
+			level = std::max(level, peak[e]);
+		}
+		float cut = PartialLod::cut(level);
+		double cyclesPerHz = 1. / Sync::master().spu();
+		for(int j=0; j<PARTIALS; ++j){
+			unsigned k = s*PARTIALS + j;
+			bool below = PartialLod::belowNyquist(double(mRatio[j] * g.freq) * cyclesPerHz);
+			if(peak[mGroup[j]] < cut || PartialLod::aliased(below)){
+				mSkipped += n - t;
+				continue;
+			}
+			mRendered += n - t;
+			size_t size = (mLanes + LANES) / LANES * LANES;
+			if(mRe.size() < size){
+				mLaneGroup.resize(size, 0);
+				mRe.resize(size, 0.f); mIm.resize(size, 0.f);
+				mLaneCos.resize(size, 0.f); mLaneSin.resize(size, 0.f);
+				mGain.resize(size, 0.f); mStep.resize(size, 0.f);
+			}
+			uint32_t phase = mPhase[k] + mInc[k] * uint32_t(t);
+			mLaneGroup[mLanes] = s*3 + mGroup[j];
+			mIm[mLanes] = sinCycle(phaseToCycle(phase));
+			mRe[mLanes] = sinCycle(phaseToCycle(phase + 0x40000000u));
+			mLaneCos[mLanes] = mCos[k];
+			mLaneSin[mLanes] = mSin[k];
+			++mLanes;
+		}
+		// the padding is silent
+		int size = std::min<int>((mLanes + LANES-1) / LANES * LANES, int(mRe.size()));
+		for(int k=mLanes; k<size; ++k) mGain[k] = mStep[k] = 0.f;
+	}
+	
+	// Gains and gain steps of every partial for the m frames from t
+	void ramp(int t, int m){
+		for(unsigned s=0; s<mActive.size(); ++s){
+			Grain& g = mGrains[mActive[s]];
+			double pos = double(mPos + t + m - g.start);
+			float gain[3], step[3];
+			for(int e=0; e<3; ++e){
+				float next = g.env[e].value(pos);
+				gain[e] = g.envAt[e] * mGroupAmp[e];
+				step[e] = (next - g.envAt[e]) / m * mGroupAmp[e];
+				g.envAt[e] = next;
+			}
+			for(int e=0; e<3; ++e){
+				mSlotGain[s*3 + e] = gain[e];
+				mSlotStep[s*3 + e] = step[e];
+			}
+		}
+		for(int k=0; k<mLanes; ++k){
+			mGain[k] = mSlotGain[mLaneGroup[k]];
+			mStep[k] = mSlotStep[mLaneGroup[k]];
+		}
+	}
+	
+	// m frames of the sum of every lane into out
+	void rotate(float * out, int m){
+		int size = (mLanes + LANES-1) / LANES * LANES;
+		if(size == 0){
+			for(int i=0; i<m; ++i) out[i] = 0.f;
+			return;
+		}
+		float * re = &mRe[0];
+		float * im = &mIm[0];
+		float * gain = &mGain[0];
+		const float * step = &mStep[0];
+		const float * c = &mLaneCos[0];
+		const float * sn = &mLaneSin[0];
+		for(int i=0; i<m; ++i){
+			float acc[LANES] = { 0 };
+			for(int k=0; k<size; k+=LANES){
+				for(int l=0; l<LANES; ++l){
+					float r = re[k+l], v = im[k+l];
+					acc[l] += v * gain[k+l];
+					gain[k+l] += step[k+l];
+					re[k+l] = r * c[k+l] - v * sn[k+l];
+					im[k+l] = r * sn[k+l] + v * c[k+l];
+				}
+			}
+			float sum = 0;
+			for(int l=0; l<LANES; ++l) sum += acc[l];
+			out[i] = sum;
+		}
+	}
+	
+	// Give grain i a slot, starting t frames into the n-frame block being
+	// rendered
+	void start(unsigned i, int t, int n){
+		const Grain& g = mGrains[i];
+		unsigned slot = unsigned(mActive.size());
+		mActive.push_back(i);
+		size_t size = mActive.size() * PARTIALS;
+		if(mPhase.size() < size){
+			mPhase.resize(size, 0); mInc.resize(size, 0);
+			mCos.resize(size, 0.f); mSin.resize(size, 0.f);
+			mSlotGain.resize(mActive.size() * 3, 0.f);
+			mSlotStep.resize(mActive.size() * 3, 0.f);
+		}
+		for(int j=0; j<PARTIALS; ++j){
+			unsigned k = slot*PARTIALS + j;
+			uint32_t inc = phaseInc(mRatio[j] * g.freq);
+			double w = 2*M_PI * double(inc) / 4294967296.;
+			mInc[k] = inc;
+			mPhase[k] = 0u - inc * uint32_t(t);	// so the block's advance leaves it at frame n - t
+			mCos[k] = float(std::cos(w));
+			mSin[k] = float(std::sin(w));
+		}
+		lanes(slot, t, n);
+	}
+	
+	// Free slot s, moving the last slot into it
+	void retire(unsigned s){
+		unsigned last = unsigned(mActive.size() - 1);
+		mActive[s] = mActive[last];
+		mActive.pop_back();
+		for(int j=0; j<PARTIALS; ++j){
+			unsigned k = s*PARTIALS + j, l = last*PARTIALS + j;
+			mPhase[k] = mPhase[l]; mInc[k] = mInc[l];
+			mCos[k] = mCos[l]; mSin[k] = mSin[l];
+		}
+	}
+};
+
+
+// ************************************************************************
+// SoundFileWriter
+//
+// Writes interleaved audio to a sound file from a background thread. Frames
+// are collected in one of two fixed buffers; when it fills, it is handed to
+// the writer thread and the other buffer takes over, so rendering only waits
+// if the disk falls a whole buffer behind and memory use doesn't depend on
+// the length of the file.
+
+struct SoundFileWriter {
+	
+	SoundFileWriter(int bufferFrames=16384)
+	:	mBufferFrames(bufferFrames), mChannels(0), mFill(0), mFull(-1), mFront(0), mQuit(false), mFailed(false)
+	{}
+	
+	~SoundFileWriter(){ close(); }
+	
+	bool open(const char * path, int channels, double frameRate,
+		SoundFile::EncodingType encoding = SoundFile::PCM_16
+	){
+		close();
+		mFile.reset(new SoundFile(path));
+		mFile->format(SoundFile::WAV).encoding(encoding).channels(channels).frameRate(frameRate);
+		if(!mFile->openWrite()){
+			mFile.reset();
+			return false;
+		}
+		mChannels = channels;
+		for(int i=0; i<2; ++i) mBuffers[i].assign(mBufferFrames * channels, 0.f);
+		mFill = 0;
+		mFull = -1;
+		mFront = 0;
+		mQuit = false;
+		mFailed = false;
+		mThread = std::thread(&SoundFileWriter::writerLoop, this);
+		return true;
+	}
+	
+	bool opened() const { return mFile.get() != 0; }
+	
+	// Append frames from one buffer per channel. False once the file has
+	// taken fewer frames than it was given; what follows is dropped.
+	bool write(const float * const * channels, int frames){
+		if(mFailed) return false;
+		int done = 0;
+		while(done < frames){
+			int n = std::min(frames - done, mBufferFrames - mFill);
+			float * dst = &mBuffers[mFront][mFill * mChannels];
+			for(int i=0; i<n; ++i)
+				for(int c=0; c<mChannels; ++c) *dst++ = channels[c][done + i];
+			mFill += n;
+			done += n;
+			if(mFill == mBufferFrames) flip();
+		}
+		return !mFailed;
+	}
+	
+	// Write what is buffered and close the file. False if any frames
+	// couldn't be written (disk full, I/O error).
+	bool close(){
+		if(!mFile.get()) return !mFailed;
+		if(mFill) flip();
+		{	std::unique_lock<std::mutex> lock(mMutex);
+			mIdle.wait(lock, [this]{ return mFull < 0; });
+			mQuit = true;
+		}
+		mReady.notify_one();
+		mThread.join();
+		mFile->close();
+		mFile.reset();
+		return !mFailed;
+	}
+	
+private:
+	std::unique_ptr<SoundFile> mFile;
+	std::vector<float> mBuffers[2];
+	int mBufferFrames, mChannels;
+	int mFill;		// frames in the front buffer
+	int mFull;		// buffer waiting to be written, -1 if none
+	int mFullFrames;
+	int mFront;
+	bool mQuit;
+	std::atomic<bool> mFailed;	// a write came up short
+	std::thread mThread;
+	std::mutex mMutex;
+	std::condition_variable mReady, mIdle;
+	
+	void flip(){
+		std::unique_lock<std::mutex> lock(mMutex);
+		mIdle.wait(lock, [this]{ return mFull < 0; });
+		mFull = mFront;
+		mFullFrames = mFill;
+		mFront = 1 - mFront;
+		mFill = 0;
+		lock.unlock();
+		mReady.notify_one();
+	}
+	
+	void writerLoop(){
+		while(true){
+			int which, frames;
+			{	std::unique_lock<std::mutex> lock(mMutex);
+				mReady.wait(lock, [this]{ return mQuit || mFull >= 0; });
+				if(mFull < 0) return;
+				which = mFull;
+				frames = mFullFrames;
+			}
+			if(!mFailed && mFile->write(&mBuffers[which][0], frames) != frames) mFailed = true;
+			{	std::lock_guard<std::mutex> lock(mMutex);
+				mFull = -1;
+			}
+			mIdle.notify_one();
+		}
+	}
+};
+
+
+// ************************************************************************
+// TableCache
+//
+// Keeps generated wavetables on disk so each is summed once instead of at
+// every start. A table is stored raw under a hash of its recipe (the call
+// that builds it, its arguments and the table size) and mapped back in on
+// later runs. With no directory every table is simply built.
+
+static const uint64_t FNV_BASIS = 14695981039346656037ULL;
+
+// FNV-1a, continuing from h
+inline uint64_t fnv1a(uint64_t h, const void * data, size_t size){
+	const unsigned char * p = static_cast<const unsigned char *>(data);
+	for(size_t i=0; i<size; ++i){
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+struct TableCache {
+	enum { VERSION = 1 };	// bump when the way tables are built changes
+	
+	// Recipe hash; pass it every argument the table is built from
+	struct Key {
+		uint64_t hash;
+		
+		Key(const char * recipe, unsigned size): hash(FNV_BASIS) {
+			unsigned version = VERSION;
+			hash = fnv1a(hash, &version, sizeof(version));
+			hash = fnv1a(hash, recipe, strlen(recipe));
+			hash = fnv1a(hash, &size, sizeof(size));
+		}
+		Key& operator()(float v){ hash = fnv1a(hash, &v, sizeof(v)); return *this; }
+		Key& operator()(const float * v, int n){ hash = fnv1a(hash, v, n*sizeof(float)); return *this; }
+	};
+	
+	TableCache(const std::string& dir=""): mDir(dir), mLoaded(0), mBuilt(0) {
+		if(!mDir.empty()) mkdir(mDir.c_str(), 0755);
+	}
+	
+	// Fill t from the cache, or run build() to fill it and store the result
+	template <class Build>
+	void table(ArrayPow2<float>& t, const Key& key, Build build){
+		if(mDir.empty()){
+			build();
+			++mBuilt;
+			return;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "/table-%016llx.f32", (unsigned long long)key.hash);
+		std::string path = mDir + name;
+		if(load(t, path)){
+			++mLoaded;
+			return;
+		}
+		build();
+		++mBuilt;
+		store(t, path);
+	}
+	
+	int loaded() const { return mLoaded; }
+	int built() const { return mBuilt; }
+	
+private:
+	std::string mDir;
+	int mLoaded, mBuilt;
+	
+	static bool load(ArrayPow2<float>& t, const std::string& path){
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0) return false;
+		size_t bytes = t.size() * sizeof(float);
+		struct stat st;
+		bool ok = fstat(fd, &st) == 0 && size_t(st.st_size) == bytes;
+		if(ok){
+			void * p = mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			ok = p != MAP_FAILED;
+			if(ok){
+				memcpy(&t[0], p, bytes);
+				munmap(p, bytes);
+			}
+		}
+		close(fd);
+		return ok;
+	}
+	
+	// written under a temporary name so a partly written table is never read
+	static void store(const ArrayPow2<float>& t, const std::string& path){
+		std::string tmp = path + ".part";
+		FILE * f = fopen(tmp.c_str(), "wb");
+		if(!f) return;
+		bool ok = fwrite(&t[0], sizeof(float), t.size(), f) == t.size();
+		ok = fclose(f) == 0 && ok;
+		if(ok) std::rename(tmp.c_str(), path.c_str());
+		else std::remove(tmp.c_str());
+	}
+};
+
+
+// ************************************************************************
+// VoicePool
+//
+// Free list of fixed size slots for voices. Slots are carved out of 64-byte
+// aligned slabs that are kept until the pool is destroyed, so once a pool has
+// grown to the polyphony of the piece, adding and freeing notes never goes
+// through malloc.
+
+struct VoicePool {
+	enum { ALIGN = 64 };
+	
+	VoicePool(size_t slotSize, size_t slotsPerSlab=256)
+	:	mSlotSize((slotSize + ALIGN-1) / ALIGN * ALIGN), mSlotsPerSlab(slotsPerSlab),
+		mFree(0), mCapacity(0), mInUse(0), mHighWater(0)
+	{}
+	
+	~VoicePool(){
+		for(unsigned i=0; i<mSlabs.size(); ++i) ::operator delete(mSlabs[i]);
+	}
+	
+	void * alloc(){
+		if(!mFree) grow(mSlotsPerSlab);
+		Slot * s = mFree;
+		mFree = s->next;
+		if(++mInUse > mHighWater) mHighWater = mInUse;
+		return s;
+	}
+	
+	void release(void * p){
+		Slot * s = static_cast<Slot *>(p);
+		s->next = mFree;
+		mFree = s;
+		--mInUse;
+	}
+	
+	// Make sure n slots can be handed out without growing
+	void reserve(size_t n){
+		if(n > mCapacity - mInUse) grow(n - (mCapacity - mInUse));
+	}
+	
+	// Grow to at least n slots in all
+	void capacity(size_t n){
+		if(n > mCapacity) grow(n - mCapacity);
+	}
+	
+	// No free slot: the next alloc() would have to grow the pool
+	bool full() const { return !mFree; }
+	
+	size_t slotSize() const { return mSlotSize; }
+	size_t capacity() const { return mCapacity; }
+	size_t inUse() const { return mInUse; }
+	size_t highWater() const { return mHighWater; }
+	
+private:
+	struct Slot { Slot * next; };
+	
+	size_t mSlotSize, mSlotsPerSlab;
+	Slot * mFree;
+	size_t mCapacity, mInUse, mHighWater;
+	std::vector<void *> mSlabs;
+	
+	void grow(size_t slots){
+		void * raw = ::operator new(slots * mSlotSize + ALIGN);
+		mSlabs.push_back(raw);
+		char * base = (char *)(((uintptr_t)raw + ALIGN-1) & ~uintptr_t(ALIGN-1));
+		for(size_t i=slots; i-- > 0;){
+			Slot * s = reinterpret_cast<Slot *>(base + i*mSlotSize);
+			s->next = mFree;
+			mFree = s;
+		}
+		mCapacity += slots;
+	}
+};
+
+
+// A note waiting to be played: which instrument, when, and the arguments to
+// its set(...) in order. The arguments live in VoiceScheduler's flat
+// parameter array; OscTrm's wavetable is kept by pointer.
+struct NoteRecord {
+	double start;				// seconds
+	ArrayPow2<float> * table;
+	uint16_t type;				// voice type id, 0 for a voice built up front
+	uint16_t numParams;
+	uint32_t firstParam;		// index into the parameter array (or prebuilt voice)
+	uint32_t seq;				// order added, breaks ties between equal starts
+	uint16_t section;			// VoiceScheduler section the note belongs to
+	uint16_t bus;				// VoiceScheduler bus the voice is routed to
+};
+
+
+// Pending notes as a binary min-heap on (start, seq). Notes can be added in
+// any order for O(log n), and each block only pops the notes that are due.
+struct EventQueue {
+	EventQueue(): mSeq(0) {}
+	
+	void push(NoteRecord r){
+		r.seq = mSeq++;
+		mHeap.push_back(r);
+		std::push_heap(mHeap.begin(), mHeap.end(), later);
+	}
+	
+	const NoteRecord& top() const { return mHeap.front(); }
+	
+	void pop(){
+		std::pop_heap(mHeap.begin(), mHeap.end(), later);
+		mHeap.pop_back();
+	}
+	
+	bool empty() const { return mHeap.empty(); }
+	size_t size() const { return mHeap.size(); }
+	void reserve(size_t n){ mHeap.reserve(n); }
+	
+	// Unordered access, for cleaning up
+	const NoteRecord& operator[](size_t i) const { return mHeap[i]; }
+	
+private:
+	std::vector<NoteRecord> mHeap;
+	uint32_t mSeq;
+	
+	static bool later(const NoteRecord& a, const NoteRecord& b){
+		return a.start > b.start || (a.start == b.start && a.seq > b.seq);
+	}
+};
+
+// Ring of N (a power of two) items from one producer thread to one consumer
+// thread. Neither side ever blocks, locks or allocates: push fails when the
+// ring is full.
+template <class T, unsigned N>
+struct SpscQueue {
+	SpscQueue(): mHead(0), mTail(0) {}
+	
+	// Producer
+	bool push(const T& v){
+		unsigned t = mTail.load(std::memory_order_relaxed);
+		if(t - mHead.load(std::memory_order_acquire) == N) return false;
+		mItems[t & (N-1)] = v;
+		mTail.store(t+1, std::memory_order_release);
+		return true;
+	}
+	
+	// Consumer: oldest item, or 0 if there is none
+	T * front(){
+		unsigned h = mHead.load(std::memory_order_relaxed);
+		if(h == mTail.load(std::memory_order_acquire)) return 0;
+		return &mItems[h & (N-1)];
+	}
+	
+	// Consumer: done with front()
+	void pop(){
+		mHead.store(mHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+	
+private:
+	T mItems[N];
+	std::atomic<unsigned> mHead;
+	char mPad[64];	// keeps the two indices off one cache line
+	std::atomic<unsigned> mTail;
+};
+
+// A note played live: the type and set(...) arguments travel by value
+struct LiveNote {
+	enum { MAX_PARAMS = 32 };
+	ArrayPow2<float> * table;
+	uint16_t type;
+	uint16_t numParams;
+	float params[MAX_PARAMS];
+};
+
+inline int newVoiceTypeId(){ static int next = 1; return next++; }
+
+// Small integer id for each instrument type
+template <class T>
+inline int voiceTypeId(){ static int id = newVoiceTypeId(); return id; }
+
+
+// ************************************************************************
+// CallbackProfiler
+//
+// Times each VoiceScheduler::process call against the real-time budget of
+// its block (frames / rate) and each voice's share of it. The render threads
+// only do relaxed atomic adds, so another thread can print the numbers while
+// the piece plays. In a non-real-time render the misses still show which
+// passages would glitch live.
+
+struct CallbackProfiler {
+	enum {
+		BUCKETS = 41,		// 5% of the budget each, the last one is 200% and up
+		MAX_TYPES = 32,		// voice type ids tracked
+		MISSES = 32			// most recent deadline misses kept
+	};
+	
+	typedef std::chrono::steady_clock Clock;
+	
+	CallbackProfiler(){ reset(); }
+	
+	void reset(){
+		for(int i=0; i<BUCKETS; ++i) mHist[i] = 0;
+		for(int i=0; i<MAX_TYPES; ++i){ mTypeNs[i] = 0; mTypeBlocks[i] = 0; }
+		for(int i=0; i<MISSES; ++i) mMissAt[i] = 0;
+		mCalls = 0; mMisses = 0; mTotalNs = 0; mWorstNs = 0; mWorstAt = 0; mBudgetNs = 0;
+	}
+	
+	static double nsSince(Clock::time_point t){
+		return std::chrono::duration<double, std::nano>(Clock::now() - t).count();
+	}
+	
+	// One process call that took ns for a block worth budgetNs starting at
+	// seconds into the piece; called from one thread at a time
+	void call(double ns, double budgetNs, double seconds){
+		int b = int(ns / budgetNs * 20);
+		++mHist[std::min(std::max(b, 0), BUCKETS-1)];
+		++mCalls;
+		mTotalNs += uint64_t(ns);
+		if(uint64_t(budgetNs) > mBudgetNs) mBudgetNs = uint64_t(budgetNs);	// full blocks
+		if(uint64_t(ns) > mWorstNs){
+			mWorstNs = uint64_t(ns);
+			mWorstAt = seconds;
+		}
+		if(ns > budgetNs){
+			unsigned m = mMisses++;
+			mMissAt[m % MISSES] = seconds;
+		}
+	}
+	
+	// One voice block of the given type; safe from any render thread
+	void voice(int type, double ns){
+		if(type < 0 || type >= MAX_TYPES) return;
+		mTypeNs[type].fetch_add(uint64_t(ns), std::memory_order_relaxed);
+		mTypeBlocks[type].fetch_add(1, std::memory_order_relaxed);
+	}
+	
+	unsigned calls() const { return mCalls; }
+	unsigned misses() const { return mMisses; }
+	
+	// typeNames[id] names voice type id
+	void print(const std::vector<const char *>& typeNames) const {
+		unsigned calls = mCalls, misses = mMisses;
+		double budget = double(mBudgetNs) * 1e-6;
+		printf("callbacks: %u, budget %.2f ms, average %.3f ms, worst %.3f ms at %.2f s, %u deadline misses\n",
+			calls, budget, calls ? double(mTotalNs) * 1e-6 / calls : 0., double(mWorstNs) * 1e-6,
+			double(mWorstAt), misses);
+		
+		unsigned most = 1;
+		for(int i=0; i<BUCKETS; ++i) most = std::max(most, unsigned(mHist[i]));
+		for(int i=0; i<BUCKETS; ++i){
+			unsigned n = mHist[i];
+			if(!n) continue;
+			char bar[41];
+			int len = int(40. * n / most + 0.5);
+			memset(bar, '#', len);
+			bar[len] = 0;
+			if(i == BUCKETS-1) printf("  %3d%%+     %8u %s\n", i*5, n, bar);
+			else printf("  %3d-%3d%% %8u %s\n", i*5, i*5+5, n, bar);
+		}
+		
+		if(misses){
+			printf("  latest misses at");
+			unsigned first = misses > MISSES ? misses - MISSES : 0;
+			for(unsigned m=first; m<misses; ++m) printf(" %.2f", double(mMissAt[m % MISSES]));
+			printf(" s\n");
+		}
+		
+		uint64_t voiceNs = 0;
+		for(int i=0; i<MAX_TYPES; ++i) voiceNs += mTypeNs[i];
+		for(int i=0; i<MAX_TYPES; ++i){
+			uint64_t blocks = mTypeBlocks[i], ns = mTypeNs[i];
+			if(!blocks) continue;
+			const char * name = i < int(typeNames.size()) ? typeNames[i] : "?";
+			while(*name >= '0' && *name <= '9') ++name;	// length prefix of typeid names
+			printf("  %-10s %10llu voice-blocks, %8.2f us each, %5.1f%% of voice time\n",
+				name, (unsigned long long)blocks, double(ns) * 1e-3 / blocks, 100. * ns / std::max<uint64_t>(voiceNs, 1));
+		}
+	}
+	
+private:
+	std::atomic<unsigned> mHist[BUCKETS];
+	std::atomic<uint64_t> mTypeNs[MAX_TYPES];
+	std::atomic<uint64_t> mTypeBlocks[MAX_TYPES];
+	std::atomic<double> mMissAt[MISSES];
+	std::atomic<unsigned> mCalls, mMisses;
+	std::atomic<uint64_t> mTotalNs, mWorstNs, mBudgetNs;
+	std::atomic<double> mWorstAt;
+};
+
+
+// ************************************************************************
+// VoiceScheduler
+//
+// Stand-in for gam::Scheduler used by the score. Notes are added the same way
+// (s.add<T>(startTime)), but each audio block the sounding voices are split
+// into fixed size chunks (in start order) that a pool of worker threads
+// renders into separate buffers. The chunk buffers are summed in chunk order,
+// so the mix is the same no matter how many threads render it. Voices live in
+// VoicePools, one per 64-byte size class.
+//
+// Notes added with note<T>(startTime, args...) are only stored as NoteRecords
+// in an EventQueue; the voice is built (and set(args...) applied) in the block
+// where it starts, so memory follows the polyphony rather than the length of
+// the score.
+//
+// On the block path, a voice that is releasing and whose block peak falls
+// below a floor relative to the block's mix (or an absolute floor, whichever
+// is higher) is freed early instead of running down to its own threshold.
+//
+// Notes can also be played live from one control thread while the audio
+// thread runs process(): play<T>(args...) passes them through a lock-free
+// ring and the voice is built in preallocated storage at the top of the next
+// block. The types played live must be reserve<T>()d before audio starts.
+// Each type can always play as many voices as it reserved, even with other
+// types sharing its pool; past that, or with no free slot, a note is dropped
+// rather than allocating.
+//
+// With segments(n) the piece is rendered as n time slices in parallel. Each
+// slice replays the notes that started before it and may still sound (by
+// Voice::noteLifetime) from their first block, discarding that audio. Culling
+// relative to the mix needs the whole mix, so slices don't cull at all: the
+// stitched file matches a serial render with cull(0) sample for sample.
+//
+// Every note is routed to a named bus: its instrument's (named after the
+// class, or Voice::busName) unless bus(name) was set when it was added. With a stem directory
+// set, recordNRT writes each bus to its own file next to the mix in the same
+// pass. Each voice then renders into a scratch buffer that is added to both
+// its chunk's mix and its chunk's bus, so the mix is the same as without stems.
+//
+// The score can be split into named sections. With a cache directory set,
+// recordNRT renders each section to its own stem named after a hash of the
+// section's notes and seed, the render settings and SECTION_VERSION, reuses
+// stems whose hash is unchanged, and mixes the stems into the output file.
+
+struct VoiceScheduler {
+	enum { CHUNK_SIZE = 8, BLOCK_SIZE = 256 };
+	
+	struct Entry {
+		Voice * voice;
+		VoicePool * pool;
+		int offset;		// frame within the block where the voice starts
+		int type;		// voiceTypeId
+		uint32_t seq;	// of the note's record
+		int bus;
+		uint32_t layers[Voice::MAX_LAYERS];	// seqs of the notes merged into it
+		int numLayers;
+	};
+	
+	VoiceScheduler()
+	:	mFrame(0), mFrames(0), mNumThreads(1), mBlocks(true), mMerge(true), mNumNotes(0), mSection(0),
+		mCullMix(0), mCullAbs(0), mVoiceBlocks(0), mCulled(0), mMerged(0), mSegments(1), mBus(-1), mRoute(false),
+		mLive(new SpscQueue<LiveNote, 1024>), mLiveDropped(0),
+		mNextChunk(0), mNumChunks(0), mGeneration(0), mBusy(0), mQuit(false)
+	{
+		section("score");
+		cull(-60);
+	}
+	
+	~VoiceScheduler(){
+		stopWorkers();
+		discard();
+		for(unsigned i=0; i<mPools.size(); ++i) delete mPools[i];
+	}
+	
+	// Build a voice now; it is set up through the returned reference
+	template <class T>
+	T& add(double startTime=0){
+		VoicePool& p = pool(sizeof(T));
+		T * v = new(p.alloc()) T(startTime);
+		Entry e = { v, &p, 0, voiceType<T>(), 0, 0, {}, 0 };
+		++mTypes[e.type].inUse;
+		NoteRecord r = newRecord(startTime, 0);
+		r.firstParam = uint32_t(mPrebuilt.size());
+		r.bus = uint16_t(e.bus = busFor(e.type));
+		mSections[mSection].cacheable = false;
+		mPrebuilt.push_back(e);
+		schedule(r);
+		return *v;
+	}
+	
+	// Schedule a T playing set(params...); the voice is built when it starts
+	template <class T, class... Params>
+	void note(double startTime, Params&&... params){
+		NoteRecord r = newRecord(startTime, voiceType<T>());
+		pack(r, std::forward<Params>(params)...);
+		schedule(r);
+	}
+	
+	// Same, with the set(...) arguments in an array
+	template <class T>
+	void noteArray(double startTime, const float * params, int numParams){
+		NoteRecord r = newRecord(startTime, voiceType<T>());
+		for(int i=0; i<numParams; ++i) mParams.push_back(params[i]);
+		r.numParams = uint16_t(numParams);
+		schedule(r);
+	}
+	
+	// From the control thread: play a T with set(params...) starting at the
+	// next block. False if the ring is full.
+	template <class T, class... Params>
+	bool play(Params&&... params){
+		static_assert(sizeof...(Params) <= LiveNote::MAX_PARAMS, "too many set(...) arguments");
+		LiveNote n;
+		n.table = 0;
+		n.type = uint16_t(voiceTypeId<T>());
+		n.numParams = 0;
+		packLive(n, std::forward<Params>(params)...);
+		return mLive->push(n);
+	}
+	
+	// Same, with the set(...) arguments in an array
+	template <class T>
+	bool playArray(const float * params, int numParams, ArrayPow2<float> * table=0){
+		LiveNote n;
+		n.table = table;
+		n.type = uint16_t(voiceTypeId<T>());
+		n.numParams = uint16_t(std::min<int>(numParams, LiveNote::MAX_PARAMS));
+		for(int i=0; i<n.numParams; ++i) n.params[i] = params[i];
+		return mLive->push(n);
+	}
+	
+	// Live notes dropped for want of a free voice
+	unsigned liveDropped() const { return mLiveDropped; }
+	
+	// Number of threads used to render a block (1 renders on the calling thread)
+	VoiceScheduler& threads(int n){
+		stopWorkers();
+		mNumThreads = n < 1 ? 1 : n;
+		return *this;
+	}
+	
+	int threads() const { return mNumThreads; }
+	
+	// Preallocate n voices of type T (and room to play them). Types of the
+	// same size class share a pool, which holds what they reserved together.
+	template <class T>
+	VoiceScheduler& reserve(size_t n){
+		int id = voiceType<T>();
+		mTypes[id].reserved += n;
+		size_t total = 0;
+		for(unsigned i=0; i<mTypes.size(); ++i)
+			if(mTypes[i].pool == mTypes[id].pool) total += mTypes[i].reserved;
+		mTypes[id].pool->capacity(total);
+		mActive.reserve(mActive.capacity() + n);
+		mChunkMix.reserve((mActive.capacity() / CHUNK_SIZE + 1) * 2 * BLOCK_SIZE);
+		return *this;
+	}
+	
+	// Make room for notes and their set(...) arguments
+	VoiceScheduler& reserveNotes(size_t notes, size_t params){
+		mPending.reserve(mPending.size() + notes);
+		mParams.reserve(mParams.size() + params);
+		return *this;
+	}
+	
+	// Note records, the size of each instrument, per pool slot size,
+	// capacity, voices in use and high-water mark, and the partial-samples
+	// PartialLod saved
+	void printStats() const {
+		printf("notes: %d records (%d bytes), %d parameters\n",
+			int(mNumNotes), int(mNumNotes*sizeof(NoteRecord)), int(mParams.size()));
+		for(unsigned i=0; i<mTypes.size(); ++i){
+			if(!mTypes[i].make) continue;
+			printf("voice %-10s %5d bytes, %2d cache lines\n", typeName(i), int(mTypes[i].size),
+				int((mTypes[i].size + 63) / 64));
+		}
+		for(unsigned i=0; i<mPools.size(); ++i){
+			const VoicePool * p = mPools[i];
+			if(!p) continue;
+			printf("pool %4d bytes: capacity %6d, in use %6d, high water %6d\n",
+				int(p->slotSize()), int(p->capacity()), int(p->inUse()), int(p->highWater()));
+		}
+		printf("voice-blocks: %lld rendered, %lld voices culled, %lld notes merged into layers\n",
+			mVoiceBlocks, mCulled, mMerged);
+		long long rendered = PartialLod::rendered(), skipped = PartialLod::skipped();
+		if(rendered + skipped)
+			printf("partial-samples: %lld rendered, %lld skipped (%.1f%%)\n",
+				rendered, skipped, 100. * skipped / (rendered + skipped));
+	}
+	
+	// Start a section; notes added from here on belong to it. The seed is part
+	// of the section's cache key (pass the seed its random choices used).
+	VoiceScheduler& section(const char * name, uint64_t seed=0){
+		for(unsigned i=0; i<mSections.size(); ++i){
+			if(mSections[i].name == name){
+				mSection = i;
+				mSections[i].seed = seed;
+				return *this;
+			}
+		}
+		Section sec = { name, seed, true };
+		mSections.push_back(sec);
+		mSection = unsigned(mSections.size() - 1);
+		return *this;
+	}
+	
+	// Render recordNRT as n time slices on up to threads() threads (not with
+	// stems, a cache or add<T>() voices, which render serially)
+	VoiceScheduler& segments(int n){ mSegments = std::max(n, 1); return *this; }
+	
+	// Route notes added from here on to the named bus (0: each to its
+	// instrument's bus, the default)
+	VoiceScheduler& bus(const char * name){
+		mBus = name ? busIndex(name) : -1;
+		return *this;
+	}
+	
+	// Directory recordNRT writes a stem per bus to ("" turns stems off)
+	VoiceScheduler& stems(const char * dir){ mStemDir = dir; return *this; }
+	
+	// Directory for cached section stems ("" turns caching off)
+	VoiceScheduler& cache(const char * dir){ mCacheDir = dir; return *this; }
+	
+	// Free releasing voices once they peak dBMix below the block's mix or below
+	// dBFS. dBMix >= 0 turns culling off.
+	VoiceScheduler& cull(float dBMix, float dBFS=-120){
+		mCullMix = dBMix < 0 ? std::pow(10.f, dBMix/20) : 0;
+		mCullAbs = dBMix < 0 ? std::pow(10.f, dBFS/20) : 0;
+		return *this;
+	}
+	
+	// Render voices through onBlock (default) or the per-sample onProcess
+	VoiceScheduler& blocks(bool v){ mBlocks=v; return *this; }
+	
+	// Let a note starting on the same frame as another of its type become a
+	// layer of that voice when they can share an oscillator (see
+	// Voice::layer); on by default, block path only
+	VoiceScheduler& merge(bool v){ mMerge=v; return *this; }
+	
+	bool empty() const { return mActive.empty() && mPending.empty(); }
+	
+	// The audio device's settings, as with gam::Scheduler::io(). recordNRT
+	// writes at the frame rate mapped here (Sync::master()'s until then).
+	struct IO {
+		double fps;
+		IO(): fps(0){}
+		template <class T>
+		IO& mapAudioIOData(T& io){ fps = io.framesPerSecond(); return *this; }
+	};
+	IO& io(){ return mIO; }
+	
+	double framesPerSecond() const { return mIO.fps > 0 ? mIO.fps : Sync::master().spu(); }
+	
+	// Time every process call and voice block (see CallbackProfiler)
+	VoiceScheduler& profile(bool v){
+		if(v && !mProfiler) mProfiler.reset(new CallbackProfiler);
+		if(!v) mProfiler.reset();
+		return *this;
+	}
+	
+	// The profiler's numbers so far; can be called while another thread renders
+	void printProfile() const {
+		if(!mProfiler) return;
+		std::vector<const char *> names;
+		for(unsigned i=0; i<mTypes.size(); ++i) names.push_back(mTypes[i].name);
+		mProfiler->print(names);
+	}
+	
+	// Render the next frames into outL/outR (added to what is there)
+	void process(float * outL, float * outR, int frames){
+		CallbackProfiler::Clock::time_point t0;
+		if(mProfiler) t0 = CallbackProfiler::Clock::now();
+		
+		// activate voices starting in this block
+		double fps = framesPerSecond();
+		while(LiveNote * n = mLive->front()){
+			spawnLive(*n, mFrame / fps);
+			mLive->pop();
+		}
+		long long blockEnd = mFrame + frames;
+		size_t started = mActive.size();
+		while(!mPending.empty()){
+			const NoteRecord& r = mPending.top();
+			long long startFrame = (long long)(r.start * fps + 0.5);
+			if(startFrame >= blockEnd) break;
+			Entry e = r.type ? spawn(r) : mPrebuilt[r.firstParam];
+			e.offset = startFrame > mFrame ? int(startFrame - mFrame) : 0;
+			if(!(r.type && merge(e, started))) mActive.push_back(e);
+			mPending.pop();
+		}
+		
+		if(!mActive.empty()){
+			mFrames = frames;
+			mNumChunks = int((mActive.size() + CHUNK_SIZE-1) / CHUNK_SIZE);
+			if(mChunkMix.size() < unsigned(mNumChunks*2*frames))
+				mChunkMix.resize(mNumChunks*2*frames);
+			if(mRoute && mBusMix.size() < mNumChunks*mBuses.size()*2*frames)
+				mBusMix.resize(mNumChunks*mBuses.size()*2*frames);
+			
+			runChunks();
+			mVoiceBlocks += mActive.size();
+			
+			for(int c=0; c<mNumChunks; ++c){
+				const float * mixL = &mChunkMix[c*2*frames];
+				const float * mixR = mixL + frames;
+				for(int i=0; i<frames; ++i){
+					outL[i] += mixL[i];
+					outR[i] += mixR[i];
+				}
+			}
+			if(mRoute){
+				size_t busFrames = mBuses.size()*2*frames;
+				for(int c=0; c<mNumChunks; ++c){
+					const float * mix = &mBusMix[c*busFrames];
+					for(size_t i=0; i<busFrames; ++i) mBusOut[i] += mix[i];
+				}
+			}
+			
+			bool cull = (mCullMix > 0 || mCullAbs > 0) && mBlocks;	// onProcess doesn't set mPeak
+			float mixPeak = 0;
+			if(cull && mCullMix > 0){
+				for(int i=0; i<frames; ++i)
+					mixPeak = std::max(mixPeak, std::max(std::fabs(outL[i]), std::fabs(outR[i])));
+			}
+			float cullBelow = std::max(mixPeak * mCullMix, mCullAbs);
+			
+			// reclaim voices that freed themselves or fell below the floor
+			unsigned j=0;
+			for(unsigned i=0; i<mActive.size(); ++i){
+				Voice * v = mActive[i].voice;
+				if(v->done()) recycle(mActive[i]);
+				else if(cull && v->releasing() && v->mPeak < cullBelow){
+					recycle(mActive[i]);
+					++mCulled;
+				}
+				else { mActive[i].offset = 0; mActive[j++] = mActive[i]; }
+			}
+			mActive.resize(j);
+		}
+		
+		if(mProfiler)
+			mProfiler->call(CallbackProfiler::nsSince(t0), frames * 1e9 / fps, mFrame / fps);
+		mFrame = blockEnd;
+	}
+	
+	// Render the score to a stereo sound file. With durationSec <= 0 it stops
+	// once no notes are pending or sounding; otherwise after durationSec.
+	void recordNRT(const char * soundFilePath, double durationSec=0){
+		if(mSegments > 1 && (!mStemDir.empty() || !mCacheDir.empty() || !mPrebuilt.empty())){
+			const char * why = !mStemDir.empty() ? "stems" : !mCacheDir.empty() ? "a section cache"
+				: "voices built with add<T>()";
+			printf("VoiceScheduler: segments(%d) ignored with %s; rendering serially\n", mSegments, why);
+		}
+		if(!mStemDir.empty()){
+			recordStems(soundFilePath, durationSec);
+			return;
+		}
+		if(!mCacheDir.empty()){
+			// a section can't cull relative to the whole mix; the dBFS floor
+			// doesn't depend on the other sections, so that one stays
+			float cullMix = mCullMix;
+			if(mCullMix > 0) printf("VoiceScheduler: sections cull only below the dBFS floor, not relative to the mix\n");
+			mCullMix = 0;
+			recordSections(soundFilePath, durationSec);
+			mCullMix = cullMix;
+			return;
+		}
+		if(mSegments > 1 && mPrebuilt.empty()){
+			recordSegments(soundFilePath, durationSec);
+			return;
+		}
+		SoundFileWriter writer;
+		if(!writer.open(soundFilePath, 2, framesPerSecond())){
+			printf("VoiceScheduler: could not open %s for writing\n", soundFilePath);
+			return;
+		}
+		bool ok = render(writer, durationSec);
+		if(!writer.close() || !ok) printf("VoiceScheduler: could not write all of %s\n", soundFilePath);
+	}
+	
+	static void audioCB(AudioIOData& io){
+		VoiceScheduler& s = *static_cast<VoiceScheduler *>(io.user());
+		s.process(io.outBuffer(0), io.outBuffer(1), io.framesPerBuffer());
+	}
+	
+private:
+	enum { SECTION_VERSION = 3 };	// bump when a change to the voices changes how they sound
+	
+	struct Section {
+		std::string name;
+		uint64_t seed;
+		bool cacheable;		// false once it holds a voice built with add<T>()
+	};
+	
+	// Render pending notes into writer from the current frame, and each bus
+	// into its stem writer if there are any. Stops early, returning false, if
+	// a writer fails.
+	bool render(SoundFileWriter& writer, double durationSec,
+		const std::vector<SoundFileWriter *>& stems = std::vector<SoundFileWriter *>()
+	){
+		double fps = framesPerSecond();
+		mRoute = !stems.empty();
+		startWorkers(fps);
 		
-		mAmpEnv.totalLength(mDur, 1);
-		mTrmEnv.totalLength(mDur);
+		long long total = durationSec > 0 ? (long long)(durationSec * fps) : -1;
+		std::vector<float> L(BLOCK_SIZE), R(BLOCK_SIZE);
+		const float * channels[2] = { &L[0], &R[0] };
+		bool ok = true;
+		for(long long done=0; ok && (total < 0 ? !empty() : done < total); done+=BLOCK_SIZE){
+			int n = total < 0 ? int(BLOCK_SIZE) : int(std::min<long long>(BLOCK_SIZE, total - done));
+			std::fill(L.begin(), L.end(), 0.f);
+			std::fill(R.begin(), R.end(), 0.f);
+			if(mRoute) mBusOut.assign(mBuses.size()*2*n, 0.f);
+			process(&L[0], &R[0], n);
+			ok = writer.write(channels, n);
+			for(unsigned b=0; b<stems.size(); ++b){
+				const float * bus[2] = { &mBusOut[b*2*n], &mBusOut[b*2*n + n] };
+				ok = stems[b]->write(bus, n) && ok;
+			}
+		}
 		
-		while(io()){
+		stopWorkers();
+		mRoute = false;
+		return ok;
+	}
+	
+	// Render the mix and a stem per bus (dir/<bus>.wav) in one pass
+	void recordStems(const char * soundFilePath, double durationSec){
+		double fps = framesPerSecond();
+		mkdir(mStemDir.c_str(), 0755);
+		SoundFileWriter writer;
+		if(!writer.open(soundFilePath, 2, fps)){
+			printf("VoiceScheduler: could not open %s for writing\n", soundFilePath);
+			return;
+		}
+		std::vector<std::unique_ptr<SoundFileWriter> > files;
+		std::vector<SoundFileWriter *> stems;
+		for(unsigned b=0; b<mBuses.size(); ++b){
+			std::string path = mStemDir + "/" + mBuses[b] + ".wav";
+			files.push_back(std::unique_ptr<SoundFileWriter>(new SoundFileWriter));
+			if(!files.back()->open(path.c_str(), 2, fps, SoundFile::FLOAT)){
+				printf("VoiceScheduler: could not open %s for writing\n", path.c_str());
+				return;
+			}
+			stems.push_back(files.back().get());
+		}
+		render(writer, durationSec, stems);
+		if(!writer.close()) printf("VoiceScheduler: could not write all of %s\n", soundFilePath);
+		for(unsigned b=0; b<files.size(); ++b){
+			if(!files[b]->close())
+				printf("VoiceScheduler: could not write all of %s/%s.wav\n", mStemDir.c_str(), mBuses[b].c_str());
+		}
+		
+		printf("stems:");
+		for(unsigned b=0; b<mBuses.size(); ++b) printf(" %s", mBuses[b].c_str());
+		printf(" (in %s)\n", mStemDir.c_str());
+	}
+	
+	struct Segment {
+		std::vector<float> audio;		// interleaved stereo
+		std::vector<uint32_t> replayed;	// notes started before the slice, as indices
+		std::vector<uint32_t> carried;	// notes still sounding at its end
+	};
+	
+	// Render time slices of the piece on separate threads and write them in order
+	void recordSegments(const char * soundFilePath, double durationSec){
+		double fps = framesPerSecond();
+		if(mCullMix > 0 || mCullAbs > 0) printf("VoiceScheduler: segments render without culling (as with cull(0))\n");
+		std::vector<NoteRecord> notes;
+		notes.reserve(mPending.size());
+		while(!mPending.empty()){
+			notes.push_back(mPending.top());
+			mPending.pop();
+		}
+		
+		// first frame of each note and a frame it has surely ended by
+		std::vector<long long> begin(notes.size()), end(notes.size());
+		long long lastBegin = 0;
+		for(unsigned i=0; i<notes.size(); ++i){
+			const NoteRecord& r = notes[i];
+			double life = mTypes[r.type].lifetime(r.start, &mParams[0] + r.firstParam, r.numParams);
+			begin[i] = (long long)(r.start * fps + 0.5);
+			end[i] = life < 1e20 ? begin[i] + (long long)(life * fps) + 2*BLOCK_SIZE : LLONG_MAX;
+			lastBegin = std::max(lastBegin, begin[i]);
+		}
+		
+		// notes merge into a voice's layers only with notes of their type and
+		// bus starting on the same frame: give those the longest lifetime among
+		// them, so a slice replays such a voice whole or not at all
+		if(mMerge){
+			for(unsigned i=0, j; i<notes.size(); i=j){
+				for(j=i; j<notes.size() && begin[j] == begin[i]; ++j){}
+				for(unsigned a=i; a<j; ++a)
+					for(unsigned b=i; b<j; ++b)
+						if(notes[a].type == notes[b].type && notes[a].bus == notes[b].bus) end[a] = std::max(end[a], end[b]);
+			}
+		}
+		
+		// block-aligned slice starts; with no fixed length the last slice runs
+		// until the piece ends
+		long long total = durationSec > 0 ? (long long)(durationSec * fps) : -1;
+		long long span = total > 0 ? total : lastBegin + 1;
+		int n = mSegments;
+		std::vector<long long> starts;
+		for(int k=0; k<n; ++k) starts.push_back(span * k / n / BLOCK_SIZE * BLOCK_SIZE);
+		starts.push_back(total);
+		
+		std::vector<Segment> segs(n);
+		std::atomic<int> next(0);
+		auto work = [&]{
+			int k;
+			while((k = next++) < n) renderSegment(notes, begin, end, starts[k], starts[k+1], segs[k]);
+		};
+		std::vector<std::thread> threads;
+		for(int i=1; i<std::min(mNumThreads, n); ++i) threads.push_back(std::thread(work));
+		work();
+		for(unsigned i=0; i<threads.size(); ++i) threads[i].join();
+		
+		// every note sounding across a boundary must have been replayed by
+		// the next slice, or a noteLifetime() is too short somewhere
+		int replayed = 0, missed = 0;
+		for(int k=0; k<n; ++k){
+			replayed += int(segs[k].replayed.size());
+			if(k+1 == n) continue;
+			const std::vector<uint32_t>& r = segs[k+1].replayed;
+			for(unsigned i=0; i<segs[k].carried.size(); ++i)
+				if(!std::binary_search(r.begin(), r.end(), segs[k].carried[i])) ++missed;
+		}
+		printf("segments: %d, %d notes replayed", n, replayed);
+		if(missed) printf(", %d notes across a boundary NOT replayed (the slices won't match)", missed);
+		printf("\n");
+		
+		SoundFileWriter writer;
+		if(!writer.open(soundFilePath, 2, fps)){
+			printf("VoiceScheduler: could not open %s for writing\n", soundFilePath);
+			return;
+		}
+		std::vector<float> L(BLOCK_SIZE), R(BLOCK_SIZE);
+		const float * channels[2] = { &L[0], &R[0] };
+		bool ok = true;
+		for(int k=0; k<n && ok; ++k){
+			const std::vector<float>& a = segs[k].audio;
+			for(size_t i=0; i<a.size() && ok; i+=2*BLOCK_SIZE){
+				int m = int(std::min<size_t>(BLOCK_SIZE, (a.size() - i) / 2));
+				for(int j=0; j<m; ++j){
+					L[j] = a[i + 2*j];
+					R[j] = a[i + 2*j + 1];
+				}
+				ok = writer.write(channels, m);
+			}
+		}
+		if(!writer.close() || !ok) printf("VoiceScheduler: could not write all of %s\n", soundFilePath);
+	}
+	
+	// Frames [from, to) of the piece (to < 0: until it ends) into seg.audio
+	void renderSegment(
+		const std::vector<NoteRecord>& notes, const std::vector<long long>& begin,
+		const std::vector<long long>& end, long long from, long long to, Segment& seg
+	){
+		VoiceScheduler slice;
+		slice.mBlocks = mBlocks;
+		slice.mMerge = mMerge;
+		slice.mIO = mIO;
+		slice.mCullMix = 0;
+		slice.mCullAbs = 0;
+		slice.mParams = mParams;
+		slice.mTypes = mTypes;
+		for(unsigned i=0; i<slice.mTypes.size(); ++i)
+			if(slice.mTypes[i].make) slice.mTypes[i].pool = &slice.pool(slice.mTypes[i].size);
+		
+		// its notes, and the earlier ones that may still sound, in the order
+		// the serial render starts them
+		std::vector<uint32_t> index;
+		long long replayFrom = from;
+		for(unsigned i=0; i<notes.size(); ++i){
+			bool inside = begin[i] >= from && (to < 0 || begin[i] < to);
+			bool before = begin[i] < from && end[i] > from;
+			if(!inside && !before) continue;
+			if(before){
+				seg.replayed.push_back(i);
+				replayFrom = std::min(replayFrom, begin[i] / BLOCK_SIZE * BLOCK_SIZE);
+			}
+			slice.mPending.push(notes[i]);
+			index.push_back(i);
+		}
+		
+		// replay up to the slice in the serial render's blocks, discarding it
+		std::vector<float> L(BLOCK_SIZE), R(BLOCK_SIZE);
+		slice.mFrame = replayFrom;
+		while(slice.mFrame < from){
+			int m = int(std::min<long long>(BLOCK_SIZE, from - slice.mFrame));
+			std::fill(L.begin(), L.end(), 0.f);
+			std::fill(R.begin(), R.end(), 0.f);
+			slice.process(&L[0], &R[0], m);
+		}
+		
+		while(to < 0 ? !slice.empty() : slice.mFrame < to){
+			int m = to < 0 ? int(BLOCK_SIZE) : int(std::min<long long>(BLOCK_SIZE, to - slice.mFrame));
+			std::fill(L.begin(), L.end(), 0.f);
+			std::fill(R.begin(), R.end(), 0.f);
+			slice.process(&L[0], &R[0], m);
+			for(int j=0; j<m; ++j){
+				seg.audio.push_back(L[j]);
+				seg.audio.push_back(R[j]);
+			}
+		}
+		
+		for(unsigned i=0; i<slice.mActive.size(); ++i){
+			const Entry& e = slice.mActive[i];
+			seg.carried.push_back(index[e.seq]);
+			for(int l=0; l<e.numLayers; ++l) seg.carried.push_back(index[e.layers[l]]);
+		}
+		slice.stopWorkers();
+	}
+	
+	// Render every section whose stem isn't cached, then mix all the stems
+	void recordSections(const char * soundFilePath, double durationSec){
+		double fps = framesPerSecond();
+		mkdir(mCacheDir.c_str(), 0755);
+		
+		std::vector<NoteRecord> notes;
+		notes.reserve(mPending.size());
+		while(!mPending.empty()){
+			notes.push_back(mPending.top());
+			mPending.pop();
+		}
+		
+		std::vector<unsigned> count(mSections.size(), 0);
+		for(unsigned i=0; i<notes.size(); ++i) ++count[notes[i].section];
+		
+		std::vector<std::string> stems;
+		int rendered = 0, reused = 0;
+		for(unsigned k=0; k<mSections.size(); ++k){
+			const Section& sec = mSections[k];
+			if(!count[k]) continue;
+			char hash[17] = "uncached";
+			if(sec.cacheable)
+				snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)sectionHash(k, notes, fps, durationSec));
+			std::string stem = mCacheDir + "/" + sec.name + "-" + hash + ".wav";
+			stems.push_back(stem);
 			
-			mTrm.freq(mTrmEnv());
-			//float trmAmp = mAmp - mTrm()*mTrmDepth; // Replaced with line below
-			float trmAmp = (mTrm()*0.5+0.5)*mTrmDepth + (1-mTrmDepth); // Corrected
-			float s1 = mOsc() * mAmpEnv() * trmAmp * mAmp;
-			float s2;
-			mEnvFollow(s1);
-			mPan(s1, s1,s2);
-			io.out(0) += s1;
-			io.out(1) += s2;
+			FILE * f = sec.cacheable ? fopen(stem.c_str(), "rb") : 0;
+			if(f){
+				fclose(f);
+				++reused;
+				continue;
+			}
+			
+			// only this section's notes, from time 0; written under a temporary
+			// name so an interrupted render never looks like a cached stem
+			for(unsigned i=0; i<notes.size(); ++i)
+				if(notes[i].section == k) mPending.push(notes[i]);
+			mFrame = 0;
+			std::string tmp = stem + ".part";
+			SoundFileWriter writer;
+			if(!writer.open(tmp.c_str(), 2, fps, SoundFile::FLOAT)){
+				printf("VoiceScheduler: could not open %s for writing\n", tmp.c_str());
+				return;
+			}
+			bool ok = render(writer, durationSec);
+			discard();	// what -length cut off belongs to this section, not the next
+			if(!writer.close() || !ok){
+				printf("VoiceScheduler: could not write all of %s\n", tmp.c_str());
+				std::remove(tmp.c_str());
+				return;
+			}
+			std::rename(tmp.c_str(), stem.c_str());
+			++rendered;
 		}
-		if(mAmpEnv.done() && (mEnvFollow.value() < 0.001)) free();
+		printf("sections: %d rendered, %d from cache\n", rendered, reused);
+		
+		mixStems(stems, soundFilePath, durationSec);
 	}
 	
-	OscTrm& freq(float v){ mOsc.freq(v); return *this; }
-	OscTrm& amp(float v){ mAmp=v; return *this; }
-	OscTrm& dur(float v){ mDur=v; return *this; }
-	OscTrm& attack(float v){ mAmpEnv.lengths()[0]=v; return *this; }
-	OscTrm& decay(float v){  mAmpEnv.lengths()[2]=v; return *this; }
-	OscTrm& sus(float v){ mAmpEnv.levels()[2]=v; return *this; }
+	// Sum stereo stems into one file, as long as the longest stem
+	void mixStems(const std::vector<std::string>& stems, const char * path, double durationSec){
+		double fps = framesPerSecond();
+		std::vector<SoundFile *> in;
+		for(unsigned i=0; i<stems.size(); ++i){
+			SoundFile * sf = new SoundFile(stems[i]);
+			if(sf->openRead() && sf->channels() == 2) in.push_back(sf);
+			else {
+				printf("VoiceScheduler: could not read stem %s\n", stems[i].c_str());
+				delete sf;
+			}
+		}
+		
+		SoundFileWriter writer;
+		if(writer.open(path, 2, fps)){
+			long long total = durationSec > 0 ? (long long)(durationSec * fps) : -1;
+			std::vector<float> buf(BLOCK_SIZE*2), L(BLOCK_SIZE), R(BLOCK_SIZE);
+			const float * channels[2] = { &L[0], &R[0] };
+			for(long long done=0; total < 0 || done < total; done+=BLOCK_SIZE){
+				int n = total < 0 ? int(BLOCK_SIZE) : int(std::min<long long>(BLOCK_SIZE, total - done));
+				std::fill(L.begin(), L.end(), 0.f);
+				std::fill(R.begin(), R.end(), 0.f);
+				int longest = 0;
+				for(unsigned k=0; k<in.size(); ++k){
+					int got = in[k]->read(&buf[0], n);
+					for(int i=0; i<got; ++i){
+						L[i] += buf[i*2];
+						R[i] += buf[i*2+1];
+					}
+					longest = std::max(longest, got);
+				}
+				if(total < 0 && longest == 0) break;
+				if(!writer.write(channels, total < 0 ? longest : n)) break;
+			}
+			if(!writer.close()) printf("VoiceScheduler: could not write all of %s\n", path);
+		}
+		else printf("VoiceScheduler: could not open %s for writing\n", path);
+		
+		for(unsigned k=0; k<in.size(); ++k){ in[k]->close(); delete in[k]; }
+	}
 	
-	OscTrm& trm1(float v){ mTrmEnv.levels(v, mTrmEnv.levels()[1], v); return *this; }
-	OscTrm& trm2(float v){ mTrmEnv.levels()[1]=v; return *this; }
-	OscTrm& trmDepth(float v){ mTrmDepth=v; return *this; }
-	OscTrm& trmRise(float v){ mTrmEnv.lengths(v,1-v); return *this; }
+	// FNV-1a over the render code's version and every setting that changes
+	// how notes sound; add new render options here
+	uint64_t settingsHash(double fps, double durationSec) const {
+		uint64_t h = FNV_BASIS;
+		unsigned version = SECTION_VERSION;
+		h = fnv1a(h, &version, sizeof(version));
+		h = fnv1a(h, &fps, sizeof(fps));
+		h = fnv1a(h, &durationSec, sizeof(durationSec));
+		h = fnv1a(h, &mBlocks, sizeof(mBlocks));
+		h = fnv1a(h, &mMerge, sizeof(mMerge));
+		h = fnv1a(h, &mCullMix, sizeof(mCullMix));
+		h = fnv1a(h, &mCullAbs, sizeof(mCullAbs));
+		h = fnv1a(h, &AddSyn::defaultControlRate(), sizeof(int));
+		h = fnv1a(h, &OscTrm::defaultTrmRate(), sizeof(int));
+		h = fnv1a(h, &PartialLod::relative(), sizeof(float));
+		return h;
+	}
 	
-	OscTrm& table(ArrayPow2<float>& v){ mOsc.source(v); return *this; }
+	// FNV-1a over everything that decides how a section sounds. Only for
+	// cacheable sections: an add<T>() note's firstParam indexes mPrebuilt.
+	uint64_t sectionHash(unsigned section, const std::vector<NoteRecord>& notes, double fps, double durationSec) const {
+		uint64_t h = settingsHash(fps, durationSec);
+		const Section& sec = mSections[section];
+		h = fnv1a(h, &sec.seed, sizeof(sec.seed));
+		for(unsigned i=0; i<notes.size(); ++i){
+			const NoteRecord& r = notes[i];
+			if(r.section != section) continue;
+			const char * name = mTypes[r.type].name;
+			h = fnv1a(h, name, strlen(name));
+			h = fnv1a(h, &r.start, sizeof(r.start));
+			h = fnv1a(h, &mParams[r.firstParam], r.numParams * sizeof(float));
+			if(r.table) h = fnv1a(h, &(*r.table)[0], r.table->size() * sizeof(float));
+		}
+		return h;
+	}
 	
-	OscTrm& pan(float v){ mPan.pos(v); return *this; }
+	long long mFrame;	// absolute frame at the start of the next block
+	int mFrames;		// frames in the block being rendered
+	int mNumThreads;
+	bool mBlocks;
+	bool mMerge;		// fold notes starting together into one voice's layers
+	size_t mNumNotes;
+	std::vector<Section> mSections;
+	unsigned mSection;	// section new notes go into
+	std::string mCacheDir;
+	float mCullMix, mCullAbs;	// culling floors as gains, 0 when off
+	long long mVoiceBlocks;		// voices rendered, summed over blocks
+	long long mCulled;
+	long long mMerged;			// notes rendered as another voice's layer
+	int mSegments;		// time slices recordNRT renders in parallel
+	IO mIO;
+	std::vector<std::string> mBuses;
+	int mBus;			// bus new notes go to, -1 for their instrument's
+	bool mRoute;		// render each bus too (into mBusOut)
+	std::string mStemDir;
+	EventQueue mPending;
+	std::vector<float> mParams;
+	std::vector<Entry> mPrebuilt;	// voices from add<T>()
+	std::vector<Entry> mActive;
+	std::vector<float> mChunkMix;
+	std::vector<float> mBusMix;		// per chunk, per bus, stereo
+	std::vector<float> mBusOut;		// per bus, stereo: the block's stems
+	std::vector<VoicePool *> mPools;	// indexed by size class
 	
+	struct VoiceType {
+		Voice * (*make)(void * mem, const NoteRecord& r, const float * params);
+		double (*lifetime)(double start, const float * params, int numParams);
+		VoicePool * pool;
+		const char * name;
+		const char * bus;	// Voice::busName
+		size_t size;
+		size_t reserved;	// voices reserve<T>() asked for
+		size_t inUse;		// voices of the type built and not yet recycled
+	};
+	std::vector<VoiceType> mTypes;		// indexed by voiceTypeId
+	std::unique_ptr<CallbackProfiler> mProfiler;
+	std::unique_ptr<SpscQueue<LiveNote, 1024> > mLive;
+	unsigned mLiveDropped;
 	
-	OscTrm& set(
-				float a, float b, float c, float d, float e, float f,
-				float g, float h, float i, float j,
-				ArrayPow2<float>& k, float l
-				){
-		return dur(a).freq(b).amp(c).attack(d).decay(e).sus(f)
-		.trmDepth(g).trm1(h).trm2(i).trmRise(j)
-		.table(k).pan(l);
+	// worker pool
+	std::vector<std::thread> mWorkers;
+	std::vector<AudioIO *> mScratch;	// one render buffer per thread, [0] is the caller's
+	std::vector<AudioIO *> mVoiceScratch;	// one voice's block per thread, when routing
+	std::atomic<int> mNextChunk;
+	int mNumChunks;
+	unsigned mGeneration;
+	int mBusy;
+	bool mQuit;
+	std::mutex mMutex;
+	std::condition_variable mWake, mDone;
+	
+	VoicePool& pool(size_t size){
+		unsigned c = unsigned((size + VoicePool::ALIGN-1) / VoicePool::ALIGN);
+		if(c >= mPools.size()) mPools.resize(c+1, (VoicePool *)0);
+		if(!mPools[c]) mPools[c] = new VoicePool(c * VoicePool::ALIGN);
+		return *mPools[c];
 	}
 	
-	OscTrm(double startTime=0)
-	:	mAmp(1), mDur(2)
-	{
-		dt(startTime);
-		set(10, 262, 0.5, 0.1,2,0.8, 0.4,4,8,0.5, mOsc, 0.8);
-		mAmpEnv.levels(0,1,1,0);
+	template <class T>
+	static Voice * makeVoice(void * mem, const NoteRecord& r, const float * params){
+		T * v = new(mem) T(r.start);
+		v->set(params, r.numParams, r.table);
+		return v;
 	}
 	
-};
-
-
-struct AddSyn : public Process<AudioIOData> {
-    
-	float mAmp;
-	float mAmpStri;
-	float mAmpLow;
-	float mAmpUp;
-	float mDur;
-	float mOscFrq;
-	float mfreqStri1, mfreqStri2, mfreqStri3, mfreqLow1, mfreqLow2, mfreqUp1, mfreqUp2, mfreqUp3, mfreqUp4;
-	Pan<> mPan;
-	Sine<> mOsc;
-	Sine<> mOsc1;
-	Sine<> mOsc2;
-	Sine<> mOsc3;
-	Sine<> mOsc4;
-	Sine<> mOsc5;
-	Sine<> mOsc6;
-	Sine<> mOsc7;
-	Sine<> mOsc8;
-	Sine<> mOsc9;
-	Env<3> mEnvStri;
-	Env<3> mEnvLow;
-	Env<3> mEnvUp;
-	EnvFollow<> mEnvFollow;
+	template <class T>
+	int voiceType(){
+		static_assert(alignof(T) <= VoicePool::ALIGN, "voices are built in VoicePool slots, never with plain new");
+		int id = voiceTypeId<T>();
+		if(id >= int(mTypes.size())){
+			VoiceType none = { 0, 0, 0, "", 0, 0, 0, 0 };
+			mTypes.resize(id+1, none);
+		}
+		if(!mTypes[id].make){
+			mTypes[id].make = &makeVoice<T>;
+			mTypes[id].lifetime = &T::noteLifetime;
+			mTypes[id].pool = &pool(sizeof(T));
+			mTypes[id].name = typeid(T).name();
+			mTypes[id].bus = T::busName();
+			mTypes[id].size = sizeof(T);
+		}
+		return id;
+	}
 	
-	void onProcess(AudioIOData& io){
-		
-		mEnvStri.totalLength(mDur, 1);
-		mEnvLow.totalLength(mDur, 1);
-		mEnvUp.totalLength(mDur, 1);
-		
-		while(io()){
-			float s1 = (mOsc1() + mOsc2() + mOsc3()) * mEnvStri() * mAmpStri;
-			s1 += (mOsc4() + mOsc5()) * mEnvLow() * mAmpLow;
-			s1 += (mOsc6() + mOsc7() + mOsc8() + mOsc9()) * mEnvUp() * mAmpUp;
-			s1 *= mAmp;
-			float s2;
-			mEnvFollow(s1);
-			mPan(s1, s1,s2);
-			io.out(0) += s1;
-			io.out(1) += s2;
+	Entry spawn(const NoteRecord& r){
+		VoiceType& t = mTypes[r.type];
+		++t.inUse;
+		Entry e = { t.make(t.pool->alloc(), r, &mParams[0] + r.firstParam), t.pool, 0, r.type, r.seq, r.bus, {}, 0 };
+		return e;
+	}
+	
+	// Never grows anything: with no free voice the note is dropped
+	void spawnLive(const LiveNote& n, double now){
+		bool known = n.type < mTypes.size() && mTypes[n.type].make;
+		if(!known || !liveSlot(n.type) || mActive.size() == mActive.capacity()){
+			++mLiveDropped;
+			return;
 		}
-		if(mEnvStri.done() && (mEnvFollow.value() < 0.0001)) free();
+		VoiceType& t = mTypes[n.type];
+		++t.inUse;
+		NoteRecord r = { now, n.table, n.type, n.numParams, 0, 0, 0, 0 };
+		Entry e = { t.make(t.pool->alloc(), r, n.params), t.pool, 0, n.type, 0, 0, {}, 0 };
+		mActive.push_back(e);
 	}
 	
-	AddSyn& freq(float v){
-		mOscFrq=v;
-		
-		mOsc1.freq(mfreqStri1*mOscFrq);
-		mOsc2.freq(mfreqStri2*mOscFrq);
-		mOsc3.freq(mfreqStri3*mOscFrq);
-		mOsc4.freq(mfreqLow1*mOscFrq);
-		mOsc5.freq(mfreqLow2*mOscFrq);
-		mOsc6.freq(mfreqUp1*mOscFrq);
-		mOsc7.freq(mfreqUp2*mOscFrq);
-		mOsc8.freq(mfreqUp3*mOscFrq);
-		mOsc9.freq(mfreqUp4*mOscFrq);
-		return *this;
+	// Whether a live note of type may take a slot: one of its own reserved
+	// ones, or a free one no other type of the pool has reserved
+	bool liveSlot(int type) const {
+		const VoiceType& t = mTypes[type];
+		if(t.pool->full()) return false;
+		if(t.inUse < t.reserved) return true;
+		size_t held = 0;	// reserved slots the pool's types aren't using
+		for(unsigned i=0; i<mTypes.size(); ++i){
+			const VoiceType& o = mTypes[i];
+			if(o.pool == t.pool && o.inUse < o.reserved) held += o.reserved - o.inUse;
+		}
+		return t.pool->capacity() - t.pool->inUse() > held;
 	}
 	
-	AddSyn& freqStri1(float v){ mfreqStri1=v; mOsc1.freq(v*mOscFrq); return *this; }
-	AddSyn& freqStri2(float v){ mfreqStri2=v; mOsc2.freq(v*mOscFrq); return *this; }
-	AddSyn& freqStri3(float v){ mfreqStri3=v; mOsc3.freq(v*mOscFrq); return *this; }
-	AddSyn& freqLow1(float v){ mfreqLow1=v; mOsc4.freq(v*mOscFrq); return *this; }
-	AddSyn& freqLow2(float v){ mfreqLow2=v; mOsc5.freq(v*mOscFrq); return *this; }
-	AddSyn& freqUp1(float v){ mfreqUp1=v; mOsc6.freq(v*mOscFrq); return *this; }
-	AddSyn& freqUp2(float v){ mfreqUp2=v; mOsc7.freq(v*mOscFrq); return *this; }
-	AddSyn& freqUp3(float v){ mfreqUp3=v; mOsc8.freq(v*mOscFrq); return *this; }
-	AddSyn& freqUp4(float v){ mfreqUp4=v; mOsc9.freq(v*mOscFrq); return *this; }
-	AddSyn& freqUp(float v1, float v2, float v3, float v4) {
-		mOsc6.freq(v1*mOscFrq);
-		mOsc7.freq(v2*mOscFrq);
-		mOsc8.freq(v3*mOscFrq);
-		mOsc9.freq(v4*mOscFrq);
-		return *this;
+	void packLive(LiveNote&){}
+	
+	template <class... Params>
+	void packLive(LiveNote& n, float v, Params&&... rest){
+		n.params[n.numParams++] = v;
+		packLive(n, std::forward<Params>(rest)...);
 	}
 	
-	AddSyn& freq(float v1, float v2) {
-		dur(v1);
-		freq(v2);
-		return *this;
+	template <class... Params>
+	void packLive(LiveNote& n, ArrayPow2<float>& table, Params&&... rest){
+		n.table = &table;
+		packLive(n, std::forward<Params>(rest)...);
 	}
 	
-	AddSyn& amp(float v){ mAmp=v; return *this; }
-	AddSyn& ampStri(float v){ mAmpStri=v; return *this; }
-	AddSyn& attackStri(float v){ mEnvStri.lengths()[0] = v; return *this; }
-	AddSyn& decayStri(float v){ mEnvStri.lengths()[2] = v; return *this; }
-	AddSyn& susStri(float v){ mEnvStri.levels()[2]=v; return *this; }
-	AddSyn& ampLow(float v){ mAmpLow=v; return *this; }
-	AddSyn& attackLow(float v){ mEnvLow.lengths()[0] = v; return *this; }
-	AddSyn& decayLow(float v){ mEnvLow.lengths()[2] = v; return *this; }
-	AddSyn& susLow(float v){ mEnvLow.levels()[2]=v; return *this; }
-	AddSyn& ampUp(float v){ mAmpUp=v; return *this; }
-	AddSyn& attackUp(float v){ mEnvUp.lengths()[0] = v; return *this; }
-	AddSyn& decayUp(float v){ mEnvUp.lengths()[2] = v; return *this; }
-	AddSyn& susUp(float v){ mEnvUp.levels()[2]=v; return *this; }
+	NoteRecord newRecord(double startTime, int type){
+		NoteRecord r = { startTime, 0, uint16_t(type), 0, uint32_t(mParams.size()), 0, uint16_t(mSection),
+			uint16_t(type ? busFor(type) : 0) };
+		return r;
+	}
 	
+	int busIndex(const std::string& name){
+		for(unsigned i=0; i<mBuses.size(); ++i)
+			if(mBuses[i] == name) return i;
+		mBuses.push_back(name);
+		return int(mBuses.size() - 1);
+	}
 	
-	AddSyn& dur(float v){ mDur=v; return *this; }
+	int busFor(int type){
+		if(mBus >= 0) return mBus;
+		return busIndex(mTypes[type].bus ? mTypes[type].bus : typeName(type));
+	}
 	
-	AddSyn& pan(float v){ mPan.pos(v); return *this; }
+	// The instrument's class name
+	const char * typeName(int type) const {
+		const char * name = mTypes[type].name;
+		while(*name >= '0' && *name <= '9') ++name;	// length prefix of typeid names
+		return name;
+	}
 	
-	AddSyn& set(
-				float a, float b, float c, float d, float e,float f, float g, float h, float i, float j,
-				float k, float l, float m, float n, float o, float p, float q, float r, float s, float t,
-				float u, float v, float w, float x, float y=0
-				){
-		return dur(a).freq(b).amp(c).ampStri(d).attackStri(e).decayStri(f).susStri(g).ampLow(h)
-		.attackLow(i).decayLow(j).susLow(k).ampUp(l).attackUp(m).decayUp(n).susUp(o)
-		.freqStri1(p).freqStri2(q).freqStri3(r).freqLow1(s).freqLow2(t).freqUp1(u)
-		.freqUp2(v).freqUp3(w).freqUp4(x).pan(y);
+	void schedule(const NoteRecord& r){
+		mPending.push(r);
+		++mNumNotes;
 	}
 	
-    AddSyn(double startTime=0)
-    
-	{
-		dt(startTime);
-		set(6.2,155.6,0.01,0.5,0.1,0.1,0.8,0.5,0.001,0.1,0.8,0.6,0.01,0.075,0.9,1,2.001,3,4.00009,5.0002,6,7,8,9);
-		//set(6.2,155.6,0.01,0.5,0.01,0.01,0.8,0.5,0.001,0.1,0.8,0.6,0.01,0.075,0.9,1,2.001,3,4.00009,5.0002,6,7,8,9);
-		mEnvStri.curve(-4); // make segments lines
-		mEnvStri.levels(0,1,1,0);
-		mEnvLow.curve(-4); // make segments lines
-		mEnvLow.levels(0,1,1,0);
-		mEnvUp.curve(-4); // make segments lines
-		mEnvUp.levels(0,1,1,0);
+	void pack(NoteRecord&){}
+	
+	template <class... Params>
+	void pack(NoteRecord& r, float v, Params&&... rest){
+		mParams.push_back(v);
+		++r.numParams;
+		pack(r, std::forward<Params>(rest)...);
+	}
+	
+	template <class... Params>
+	void pack(NoteRecord& r, ArrayPow2<float>& table, Params&&... rest){
+		r.table = &table;
+		pack(r, std::forward<Params>(rest)...);
+	}
+	
+	// Make e a layer of a voice started this block (from mActive[from]) on
+	// the same frame, type and bus, if one takes it
+	bool merge(Entry& e, size_t from){
+		if(!mMerge || !mBlocks) return false;
+		for(size_t i=from; i<mActive.size(); ++i){
+			Entry& a = mActive[i];
+			if(a.type != e.type || a.offset != e.offset || a.bus != e.bus) continue;
+			if(a.voice->layer(*e.voice)){
+				a.layers[a.numLayers++] = e.seq;
+				recycle(e);
+				++mMerged;
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	void recycle(Entry& e){
+		e.voice->~Voice();
+		e.pool->release(e.voice);
+		--mTypes[e.type].inUse;
+	}
+	
+	// Recycle every sounding voice and drop every pending note
+	void discard(){
+		for(unsigned i=0; i<mActive.size(); ++i) recycle(mActive[i]);
+		mActive.clear();
+		while(!mPending.empty()){
+			const NoteRecord& r = mPending.top();
+			if(r.type == 0) recycle(mPrebuilt[r.firstParam]);
+			mPending.pop();
+		}
+	}
+	
+	void startWorkers(double fps){
+		stopWorkers();
+		for(int i=0; i<mNumThreads; ++i){
+			mScratch.push_back(new AudioIO(BLOCK_SIZE, fps, 0, 0, 2, 0));
+			if(mRoute) mVoiceScratch.push_back(new AudioIO(BLOCK_SIZE, fps, 0, 0, 2, 0));
+		}
+		mQuit = false;
+		for(int i=1; i<mNumThreads; ++i)
+			mWorkers.push_back(std::thread(&VoiceScheduler::workerLoop, this, i, mGeneration));
+	}
+	
+	void stopWorkers(){
+		{	std::lock_guard<std::mutex> lock(mMutex);
+			mQuit = true;
+		}
+		mWake.notify_all();
+		for(unsigned i=0; i<mWorkers.size(); ++i) mWorkers[i].join();
+		mWorkers.clear();
+		for(unsigned i=0; i<mScratch.size(); ++i) delete mScratch[i];
+		mScratch.clear();
+		for(unsigned i=0; i<mVoiceScratch.size(); ++i) delete mVoiceScratch[i];
+		mVoiceScratch.clear();
+	}
+	
+	void runChunks(){
+		if(mScratch.empty()) startWorkers(framesPerSecond());
+		mNextChunk = 0;
+		if(!mWorkers.empty()){
+			{	std::lock_guard<std::mutex> lock(mMutex);
+				mBusy = int(mWorkers.size());
+				++mGeneration;
+			}
+			mWake.notify_all();
+		}
+		renderChunks(0);
+		if(!mWorkers.empty()){
+			std::unique_lock<std::mutex> lock(mMutex);
+			mDone.wait(lock, [this]{ return mBusy == 0; });
+		}
+	}
+	
+	void workerLoop(int index, unsigned seen){
+		while(true){
+			{	std::unique_lock<std::mutex> lock(mMutex);
+				mWake.wait(lock, [&]{ return mQuit || mGeneration != seen; });
+				if(mQuit) return;
+				seen = mGeneration;
+			}
+			renderChunks(index);
+			{	std::lock_guard<std::mutex> lock(mMutex);
+				--mBusy;
+			}
+			mDone.notify_one();
+		}
 	}
 	
+	// Take chunks off the shared counter until none are left
+	void renderChunks(int thread){
+		AudioIO& io = *mScratch[thread];
+		int frames = mFrames;
+		size_t busFrames = mBuses.size()*2*frames;
+		int c;
+		while((c = mNextChunk++) < mNumChunks){
+			io.zeroOut();
+			float * busMix = mRoute ? &mBusMix[c*busFrames] : 0;
+			if(mRoute) std::fill(busMix, busMix + busFrames, 0.f);
+			unsigned end = std::min<unsigned>((c+1)*CHUNK_SIZE, mActive.size());
+			for(unsigned i=c*CHUNK_SIZE; i<end; ++i){
+				Entry& e = mActive[i];
+				CallbackProfiler::Clock::time_point t0;
+				if(mProfiler) t0 = CallbackProfiler::Clock::now();
+				AudioIO& vio = mRoute ? *mVoiceScratch[thread] : io;
+				if(mRoute) vio.zeroOut();
+				if(mBlocks){
+					e.voice->onBlock(vio.outBuffer(0) + e.offset, vio.outBuffer(1) + e.offset, frames - e.offset);
+				}
+				else{
+					vio.frame(e.offset);
+					e.voice->onProcess(vio);
+				}
+				if(mRoute){
+					for(int ch=0; ch<2; ++ch){
+						const float * v = vio.outBuffer(ch);
+						float * mix = io.outBuffer(ch);
+						float * bus = busMix + (e.bus*2 + ch)*frames;
+						for(int j=e.offset; j<frames; ++j){
+							mix[j] += v[j];
+							bus[j] += v[j];
+						}
+					}
+				}
+				if(mProfiler) mProfiler->voice(e.type, CallbackProfiler::nsSince(t0));
+			}
+			float * mix = &mChunkMix[c*2*frames];
+			memcpy(mix, io.outBuffer(0), frames*sizeof(float));
+			memcpy(mix + frames, io.outBuffer(1), frames*sizeof(float));
+		}
+	}
 };
 
-struct Chimes : public AddSyn {
-    
-	Chimes(double startTime=0) :AddSyn(startTime) {
-		//set (6.2,440,0.1,0.5,0.0001,3.8,0.3,0.4,0.0001,6.0,0.99,0.3,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36);
-		set (6.2,440,0.1,0.05,0.0001,3.8,0.3,0.04,0.0001,6.0,0.99,0.03,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36);
+
+// Largest difference between the per-sample and block paths of two voices set
+// up the same way. Only the oscillators differ (Gamma's against the kernels
+// above): the sine instruments stay below 1e-4 (-80 dB), OscTrm can differ by
+// a few 1e-3 where its table jumps (tbSqr) and the phases round differently.
+// AddSyn's block path sums a PartialBank against Gamma's Sine<>s and differs
+// like the sine instruments. Compare with PartialLod off (-checkBlocks does):
+// the partials it leaves out differ by a few 1e-6 more. With refBlocks the
+// reference renders through onBlock too, to compare two block path settings.
+float blockPathError(Voice& ref, Voice& blk, double seconds, bool refBlocks=false){
+	const int frames = VoiceScheduler::BLOCK_SIZE;
+	AudioIO io(frames, Sync::master().spu(), 0, 0, 2, 0);
+	std::vector<float> L(frames), R(frames);
+	float err = 0;
+	int blocks = int(seconds * Sync::master().spu() / frames);
+	for(int b=0; b<blocks && !(ref.done() && blk.done()); ++b){
+		io.zeroOut();
+		io.frame(0);
+		if(refBlocks) ref.onBlock(io.outBuffer(0), io.outBuffer(1), frames);
+		else ref.onProcess(io);
+		std::fill(L.begin(), L.end(), 0.f);
+		std::fill(R.begin(), R.end(), 0.f);
+		blk.onBlock(&L[0], &R[0], frames);
+		for(int i=0; i<frames; ++i){
+			err = std::max(err, std::fabs(io.out(0,i) - L[i]));
+			err = std::max(err, std::fabs(io.out(1,i) - R[i]));
+		}
 	}
-};
+	return err;
+}
 
 
-struct Trumpet : public AddSyn {
-    
-	Trumpet(double startTime=0) :AddSyn(startTime) {
-		//set (6.2,440,0.1,0.5,0.0001,3.8,0.3,0.4,0.0001,6.0,0.99,0.3,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36);
-		set (6.2,440,0.5,0.05,0.0001,3.8,0.3,0.04,0.0001,6.0,0.99,0.03,0.0001,6.0,0.9,2,3,4.07,0.56,0.92,1.19,1.7,2.75,3.36);
+// ****************************************************************************
+// Score randomness
+//
+// The score's random choices come from ScoreRng, a counter-based generator:
+// draw i of a stream is SplitMix64's finalizer applied to the stream's key and
+// i, so a stream is just a key and a counter and splitting one off gives an
+// uncorrelated stream. Each section of the score draws from a stream keyed by
+// the piece's seed and the section's name (scoreSection), and each fill helper
+// call from a stream split off its section's, so the same seed always gives
+// the same notes and changing one section doesn't move the others' choices.
+
+struct ScoreRng {
+	ScoreRng(uint64_t key=0): mKey(mix(key)), mCount(0){}
+	
+	uint64_t next(){ return mix(mKey + 0x9E3779B97F4A7C15ULL * ++mCount); }
+	
+	// Uniform in [a, b)
+	float uni(float a, float b){ return a + (b - a) * float(next() >> 40) * (1.f / (1 << 24)); }
+	int uni(int a, int b){
+		if(b < a) std::swap(a, b);
+		return b > a ? a + int(next() % uint64_t(b - a)) : a;
+	}
+	
+	// A new stream, keyed by the next draw of this one
+	ScoreRng split(){ return ScoreRng(next()); }
+	
+	// The stream named name under this one's key
+	ScoreRng stream(const char * name) const {
+		return ScoreRng(mKey ^ fnv1a(FNV_BASIS, name, strlen(name)));
 	}
+	
+	static uint64_t mix(uint64_t z){
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+	
+	uint64_t mKey, mCount;
 };
 
+// The stream rand(), randint() and the fill helpers draw from
+inline ScoreRng& scoreRng(){ static ScoreRng r; return r; }
+
+// Start (or go back to) a section of the score: notes go to the scheduler's
+// section of that name and random choices continue that section's stream
+void scoreSection(VoiceScheduler &s, const char * name, uint64_t seed){
+	static std::vector<std::string> names;
+	static std::vector<ScoreRng> streams;
+	static int current = -1;
+	if(current >= 0) streams[current] = scoreRng();
+	current = int(std::find(names.begin(), names.end(), name) - names.begin());
+	if(current == int(names.size())){
+		names.push_back(name);
+		streams.push_back(ScoreRng(seed).stream(name));
+	}
+	scoreRng() = streams[current];
+	s.section(name, seed);
+}
+
 
 float rand(float a, float b) {
-    float x = al::rnd::uniform(a,b) ;
-    return x ;
+    return scoreRng().uni(a, b) ;
 }
 
 int randint(int a, int b) {
-    int x = al::rnd::uniform(a,b) ;
-//    std::cout << x << std::endl ;
-    return x;
+    return scoreRng().uni(a, b) ;
 }
 
-void sinQ (Scheduler &s, float time, float freq, float len, float amp = 0.3) {
+void sinQ (VoiceScheduler &s, float time, float freq, float len, float amp = 0.3) {
     float atk = len * 0.25;
     float dcy = len * 0.5;
-    s.add<SineEnv>( time ).set( len, freq, amp, atk, dcy);
+    s.note<SineEnv>( time, len, freq, amp, atk, dcy);
 }
 
-void sinWhole (Scheduler &s, float time, float freq, float len, float a, float d, float dt=1) {
+void sinWhole (VoiceScheduler &s, float time, float freq, float len, float a, float d, float dt=1) {
     float atk = len * 0.25 + a;
     float dcy = 1 + d;
-    s.add<SineEnv>( time ).set( len, freq, 0.1, atk * dt, dcy * dt);
+    s.note<SineEnv>( time, len, freq, 0.1, atk * dt, dcy * dt);
 }
 
 float halfStepScale[20];
@@ -310,73 +3482,295 @@ void initScaleTo12TET(float lowest) {
 	}
 }
 
-float randomFrom12TET() {
-	int index = rnd::uni(0,20);
+float randomFrom12TET(ScoreRng &rng = scoreRng()) {
+	int index = rng.uni(0,20);
 	// std::cout << "index " << index << " is " << myScale[index] << std::endl;
 	return halfStepScale[index];
 }
 
 
-void fillTime(Scheduler &s, float from, float to, float minattackStri, float minattackLow, float minattackUp, float maxattackStri, float maxattackLow, float maxattackUp, float minFreq, float maxFreq, float a) {
+// Whether the fill helpers schedule their grains as ChimeClouds (the
+// default) or each as its own Chimes
+inline bool& cloudFills(){ static bool v = true; return v; }
+
+// The grains of one fill, scheduled as ChimeClouds of up to MAX_GRAINS grains
+// (or as Chimes notes with cloudFills() off)
+struct ChimeFill {
+	ChimeFill(VoiceScheduler &s, float amp): mS(s), mAmp(amp), mStart(0) {}
+	
+	void grain(float start, float freq, float attackStri){
+		float p[Chimes::NUM_PARAMS];
+		std::copy(Chimes::defaults(), Chimes::defaults() + Chimes::NUM_PARAMS, p);
+		p[2] = mAmp;
+		if (!cloudFills()) {
+			p[4] = attackStri;
+			p[1] = freq;
+			mS.noteArray<Chimes>(start, p, Chimes::NUM_PARAMS);
+			return;
+		}
+		if (mParams.empty()) {
+			mParams.assign(p, p + Chimes::NUM_PARAMS);
+			mStart = start;
+		}
+		mParams.push_back(start);
+		mParams.push_back(freq);
+		mParams.push_back(attackStri);
+		if (mParams.size() == Chimes::NUM_PARAMS + ChimeCloud::MAX_GRAINS * ChimeCloud::GRAIN_PARAMS) flush();
+	}
+	
+	void flush(){
+		if (!mParams.empty()) mS.noteArray<ChimeCloud>(mStart, &mParams[0], int(mParams.size()));
+		mParams.clear();
+	}
+	
+	VoiceScheduler &mS;
+	float mAmp;
+	float mStart;
+	std::vector<float> mParams;
+};
+
+void fillTime(VoiceScheduler &s, float from, float to, float minattackStri, float minattackLow, float minattackUp, float maxattackStri, float maxattackLow, float maxattackUp, float minFreq, float maxFreq, float a) {
+	ScoreRng rng = scoreRng().split();
+	ChimeFill fill(s, a);
 	while (from <= to) {
-		float nextAtt = rnd::uni((minattackStri+minattackLow+minattackUp),(maxattackStri+maxattackLow+maxattackUp));
-		s.add<Chimes>(from).attackStri(nextAtt).freq(rnd::uni(minFreq,maxFreq)).amp(a);
+		float nextAtt = rng.uni((minattackStri+minattackLow+minattackUp),(maxattackStri+maxattackLow+maxattackUp));
+		float f = rng.uni(minFreq,maxFreq);
+		fill.grain(from, f, nextAtt);
 //		std::cout << "old from " << from << " plus nextnextAtt " << nextAtt << std::endl;
 		from += nextAtt;
 	}
+	fill.flush();
 }
 
-void fillTimeWith12TET(Scheduler &s, float from, float to, float minattackStri, float minattackLow, float minattackUp, float maxattackStri, float maxattackLow, float maxattackUp, float a) {
+void fillTimeWith12TET(VoiceScheduler &s, float from, float to, float minattackStri, float minattackLow, float minattackUp, float maxattackStri, float maxattackLow, float maxattackUp, float a) {
+	ScoreRng rng = scoreRng().split();
+	ChimeFill fill(s, a);
 	while (from <= to) {
-		float nextAtt = rnd::uni((minattackStri+minattackLow+minattackUp),(maxattackStri+maxattackLow+maxattackUp));
-		float f = randomFrom12TET();
-		s.add<Chimes>(from).attackStri(nextAtt).freq(f).amp(a);
+		float nextAtt = rng.uni((minattackStri+minattackLow+minattackUp),(maxattackStri+maxattackLow+maxattackUp));
+		float f = randomFrom12TET(rng);
+		fill.grain(from, f, nextAtt);
 //		std::cout << "12 old from " << from << " plus nextAtt " << nextAtt << std::endl;
 //		std::cout << "12 old from " << from << " plus nextAtt " << nextAtt << std::endl;
 		from += nextAtt;
 	}
+	fill.flush();
+}
+
+// fillTime with its attack and frequency ranges drawn at random too, in a
+// fixed order (as arguments to fillTime they'd be drawn in whatever order the
+// compiler evaluates them)
+void fillTimeRandom(VoiceScheduler &s, float from, float to, float a) {
+	float att[6], freq[2];
+	for (int i=0;i<3;++i) att[i] = rand(0.00005, 0.006);
+	for (int i=3;i<6;++i) att[i] = rand(0.05, 0.6);
+	freq[0] = rand(200, 500);
+	freq[1] = rand(500, 800);
+	fillTime(s, from, to, att[0], att[1], att[2], att[3], att[4], att[5], freq[0], freq[1], a);
+}
+
+// Largest difference between the densest fill in the score rendered as a
+// ChimeCloud and as single Chimes voices
+float cloudError(double seconds){
+	VoiceScheduler clouds, grains;
+	VoiceScheduler * fills[2] = { &clouds, &grains };
+	for (int i=0;i<2;++i) {
+		cloudFills() = i == 0;
+		scoreRng() = ScoreRng(1);
+		fills[i]->cull(0);
+		fillTime(*fills[i], 0, 2, 0.0001, 0.0001, 0.0001, 0.1, 0.1, 0.1, 200, 500, 0.05);
+	}
+	cloudFills() = true;
+	
+	const int frames = VoiceScheduler::BLOCK_SIZE;
+	std::vector<float> L[2], R[2];
+	float err = 0;
+	int blocks = int(seconds * Sync::master().spu() / frames);
+	for (int b=0;b<blocks;++b) {
+		for (int i=0;i<2;++i) {
+			L[i].assign(frames, 0.f);
+			R[i].assign(frames, 0.f);
+			fills[i]->process(&L[i][0], &R[i][0], frames);
+		}
+		for (int k=0;k<frames;++k)
+			err = std::max(err, std::max(std::fabs(L[0][k] - L[1][k]), std::fabs(R[0][k] - R[1][k])));
+	}
+	return err;
+}
+
+// Largest difference between the bass's stacked OscTrm notes merged into one
+// voice's layers and the same notes as separate voices, playing table
+float layerError(ArrayPow2<float>& table, double seconds){
+	VoiceScheduler merged, separate;
+	VoiceScheduler * bass[2] = { &merged, &separate };
+	for (int i=0;i<2;++i) {
+		bass[i]->merge(i == 0).cull(0);
+		float dt = 60.f / 80;
+		bass[i]->note<OscTrm>(0, dt * 4, 110, 0.3, dt * 0.05, dt * 0.5 , 0.1, 0.4,4,8,0.5, table, 0.8);
+		bass[i]->note<OscTrm>(0, dt * 4, 110, 0.3, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, table, 0.8);
+		bass[i]->note<OscTrm>(0, dt * 4, 55, 0.3, dt * 0.05, 0.5 , 0.1, 0.4,4,8,0.5, table, 0.8);
+		bass[i]->note<OscTrm>(0, dt * 4, 55, 0.3, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, table, 0.8);
+	}
+	
+	const int frames = VoiceScheduler::BLOCK_SIZE;
+	std::vector<float> L[2], R[2];
+	float err = 0;
+	int blocks = int(seconds * Sync::master().spu() / frames);
+	for (int b=0;b<blocks;++b) {
+		for (int i=0;i<2;++i) {
+			L[i].assign(frames, 0.f);
+			R[i].assign(frames, 0.f);
+			bass[i]->process(&L[i][0], &R[i][0], frames);
+		}
+		for (int k=0;k<frames;++k)
+			err = std::max(err, std::max(std::fabs(L[0][k] - L[1][k]), std::fabs(R[0][k] - R[1][k])));
+	}
+	return err;
 }
 
 
 
-int main() {
-    Scheduler s;
+#ifndef NLM_NO_MAIN
+int main(int argc, char * argv[]) {
+    VoiceScheduler s;
+    
+    // -threads N   : render with N threads (defaults to one per core)
+    // -perSample   : render through onProcess instead of the block kernels
+    // -checkBlocks : print the block path error of each instrument and exit
+    // -stats       : print render statistics when done
+    // -length S    : stop after S seconds instead of when the last note ends
+    // -cull DB     : free releasing voices DB below the mix (default -60, 0 = off)
+    // -profile     : time each block against its real-time budget and print
+    //                the callback histogram and cost per instrument when done
+    // -envRate K   : evaluate AddSyn's envelopes every K frames (default every frame)
+    // -trmRate K   : update OscTrm's tremolo rate every K frames (default every frame)
+    // -segments N  : render N time slices of the piece in parallel
+    // -stems DIR   : also write a stem per bus (instrument, or the bass) to DIR
+    // -grainVoices : render the chime fills grain by grain instead of as clouds
+    // -lod DB      : skip additive partials above Nyquist or DB below the
+    //                voice's loudest (default off, 0 = render them all)
+    // -noMerge     : render every note as its own voice, even when it could
+    //                be a layer of another starting with it
+    // -seed N      : seed for the score's random choices (default 1)
+    // -cache DIR   : keep wavetables and a stem per section in DIR, only
+    //                rebuilding what changed
+    int numThreads = std::thread::hardware_concurrency();
+    bool checkBlocks = false;
+    bool stats = false;
+    double length = 0;
+    const char * cacheDir = "";
+    const char * stemDir = "";
+    uint64_t seed = 1;
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-threads") && i+1 < argc) numThreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-perSample")) s.blocks(false);
+        else if (!strcmp(argv[i], "-checkBlocks")) checkBlocks = true;
+        else if (!strcmp(argv[i], "-stats")) stats = true;
+        else if (!strcmp(argv[i], "-length") && i+1 < argc) length = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-cull") && i+1 < argc) s.cull(atof(argv[++i]));
+        else if (!strcmp(argv[i], "-profile")) s.profile(true);
+        else if (!strcmp(argv[i], "-segments") && i+1 < argc) s.segments(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-trmRate") && i+1 < argc) OscTrm::defaultTrmRate() = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-envRate") && i+1 < argc) AddSyn::defaultControlRate() = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-cache") && i+1 < argc) cacheDir = argv[++i];
+        else if (!strcmp(argv[i], "-stems") && i+1 < argc) stemDir = argv[++i];
+        else if (!strcmp(argv[i], "-grainVoices")) cloudFills() = false;
+        else if (!strcmp(argv[i], "-noMerge")) s.merge(false);
+        else if (!strcmp(argv[i], "-lod") && i+1 < argc) PartialLod::threshold(atof(argv[++i]));
+        else if (!strcmp(argv[i], "-seed") && i+1 < argc) seed = strtoull(argv[++i], 0, 10);
+    }
+    s.cache(cacheDir).stems(stemDir);
+    s.threads(numThreads);
+    
+    // enough for the piece's polyphony and notes so nothing grows while it plays
+    s.reserve<SineEnv>(128).reserve<OscTrm>(64);
+    if (cloudFills()) s.reserve<ChimeCloud>(16);
+    else s.reserve<Chimes>(512);
+    s.reserveNotes(4096, 32768);
     
     ArrayPow2<float>
     tbSaw(2048), tbSqr(2048), tbImp(2048), tbSin(2048), tbPls(2048),
     tb__1(2048), tb__2(2048), tb__3(2048), tb__4(2048);
     
-	addSinesPow<1>(tbSaw, 9,1);
-	addSinesPow<1>(tbSqr, 9,2);
-	addSinesPow<0>(tbImp, 9,1);
-	addSine(tbSin);
+    // the key repeats each table's recipe so editing one rebuilds it
+    TableCache tables(cacheDir);
+    typedef TableCache::Key Key;
+    
+	tables.table(tbSaw, Key("addSinesPow<1>", 2048)(9)(1), [&]{ addSinesPow<1>(tbSaw, 9,1); });
+	tables.table(tbSqr, Key("addSinesPow<1>", 2048)(9)(2), [&]{ addSinesPow<1>(tbSqr, 9,2); });
+	tables.table(tbImp, Key("addSinesPow<0>", 2048)(9)(1), [&]{ addSinesPow<0>(tbImp, 9,1); });
+	tables.table(tbSin, Key("addSine", 2048), [&]{ addSine(tbSin); });
     
 	{	float A[] = {1,1,1,1,0.7,0.5,0.3,0.1};
-		addSines(tbPls, A,8);
+		tables.table(tbPls, Key("addSines", 2048)(A,8), [&]{ addSines(tbPls, A,8); });
 	}
     
 	{	float A[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08};
 		float C[] = {1,4,7,11,15,18};
-		addSines(tb__1, A,C,6);
+		tables.table(tb__1, Key("addSines", 2048)(A,6)(C,6), [&]{ addSines(tb__1, A,C,6); });
 	}
     
 	// inharmonic partials
 	{	float A[] = {0.5,0.8,0.7,1,0.3,0.4,0.2,0.12};
 		float C[] = {3,4,7,8,11,12,15,16};
-		addSines(tb__2, A,C,7);
+		tables.table(tb__2, Key("addSines", 2048)(A,7)(C,7), [&]{ addSines(tb__2, A,C,7); });
 	}
     
 	// inharmonic partials
 	{	float A[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08};
 		float C[] = {10, 27, 54, 81, 108, 135};
-		addSines(tb__3, A,C,6);
+		tables.table(tb__3, Key("addSines", 2048)(A,6)(C,6), [&]{ addSines(tb__3, A,C,6); });
 	}
     
 	// harmonics 20-27
 	{	float A[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
-		addSines(tb__4, A,8, 20);
+		tables.table(tb__4, Key("addSines", 2048)(A,8)(20), [&]{ addSines(tb__4, A,8, 20); });
 	}
     
+    // band-limited levels OscTrm switches to for notes the tables would alias at
+    TableMips
+    mipSaw(tbSaw), mipSqr(tbSqr), mipImp(tbImp), mipSin(tbSin), mipPls(tbPls),
+    mip__1(tb__1), mip__2(tb__2), mip__3(tb__3), mip__4(tb__4);
+    
+    if (checkBlocks) {
+        PartialLod::threshold(0);    // compare the paths, not what -lod leaves out
+        SineEnv sa, sb;
+        printf("SineEnv  block path error %g\n", blockPathError(sa, sb, 8));
+        OscTrm oa, ob;
+        oa.table(tbSqr); ob.table(tbSqr);
+        printf("OscTrm   block path error %g\n", blockPathError(oa, ob, 12));
+        AddSyn aa, ab;
+        printf("AddSyn   block path error %g\n", blockPathError(aa, ab, 8));
+        Chimes ca, cb;
+        printf("Chimes   block path error %g\n", blockPathError(ca, cb, 8));
+        
+        // envelopes at control rate against the per-sample envelopes
+        for (int k = 8; k <= 64; k *= 2) {
+            AddSyn ra, rb;
+            rb.controlRate(k);
+            Chimes ta, tb;
+            tb.controlRate(k);
+            printf("envelopes every %2d frames: AddSyn error %g, Chimes error %g\n",
+                k, blockPathError(ra, rb, 8), blockPathError(ta, tb, 8));
+        }
+        
+        // tremolo rate at control rate against the per-frame sweep
+        for (int k = 16; k <= 256; k *= 2) {
+            OscTrm ta, tb;
+            ta.table(tbSqr); tb.table(tbSqr).trmRate(k);
+            printf("tremolo rate every %3d frames: OscTrm error %g\n", k, blockPathError(ta, tb, 12, true));
+        }
+        
+        printf("chime fill as a ChimeCloud: error %g\n", cloudError(10));
+        printf("stacked OscTrm notes as layers: error %g\n", layerError(tbSin, 8));
+        
+        // the inverse-FFT backend only updates amplitudes every hop, so
+        // envelope corners are rounded off
+        AddSyn fa; AddSynFFT fb;
+        fa.controlRate(16);
+        printf("AddSynFFT against AddSyn (envelopes every 16 frames): error %g\n", blockPathError(fa, fb, 8, true));
+        return 0;
+    }
+    
     
     //     s.add<OscTrm>( time ).set(len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
 
@@ -402,6 +3796,7 @@ int main() {
 //    float melody[] = { 987.77, 1046.50, 1108.73, 783.99, 698.46, 659.25, 523.25, 587.33 } ;
     
     // A section
+    scoreSection(s, "A", seed);
     //chord
     sinWhole (s, time, 600, dt * 5, -0.06, 0.0, dt) ;
     sinWhole (s, time, 650, dt * 5, -0.03, 0.0, dt) ;
@@ -467,16 +3862,16 @@ int main() {
 //    amp = 0.01;
 //    fillTime(s,time,time + 10, 0.0001, 0.0001, 0.0001, 0.1, 0.1, 0.1, 200, 500, 0.05);
 //    
-//    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+//    fillTimeRandom(s,time,time + 2, amp);
 //    time += 2; amp = 0.05;
-//    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+//    fillTimeRandom(s,time,time + 2, amp);
 //    
 //    time += 2;
 //    
-//    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+//    fillTimeRandom(s,time,time + 2, amp);
 //    time += 2; amp = 0.07;
 //    
-//    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+//    fillTimeRandom(s,time,time + 2, amp);
 //    
 //    time += 2; amp = 0.1;
 //    
@@ -682,20 +4077,21 @@ int main() {
     
     time2 = time ;
     
+    scoreSection(s, "chimes", seed);
     initScaleTo12TET(420);
     amp = 0.01;
     fillTime(s,time,time + 10, 0.0001, 0.0001, 0.0001, 0.1, 0.1, 0.1, 200, 500, 0.05);
 
-    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time,time + 2, amp);
     time += 2; amp = 0.05;
-    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time,time + 2, amp);
     
     time += 2;
 
-    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time,time + 2, amp);
     time += 2; amp = 0.07;
 
-    fillTime(s,time,time + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time,time + 2, amp);
 
     time += 2; amp = 0.1;
 
@@ -710,16 +4106,16 @@ int main() {
     amp = 0.05;
     fillTime(s,time2,time2 + 10, 0.0001, 0.0001, 0.0001, 0.1, 0.1, 0.1, 200, 500, amp);
     
-    fillTime(s,time2,time2 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time2,time2 + 2, amp);
     time2 += 2; amp = 0.08;
-    fillTime(s,time2,time2 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time2,time2 + 2, amp);
     
     time2 += 2;
     
-    fillTime(s,time2,time2 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time2,time2 + 2, amp);
     time2 += 2; amp = 0.07;
     
-    fillTime(s,time2,time2 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time2,time2 + 2, amp);
     
     time2 += 2; amp = 0.05;
     
@@ -733,16 +4129,16 @@ int main() {
     amp = 0.05;
     fillTime(s,time3,time3 + 10, 0.0001, 0.0001, 0.0001, 0.1, 0.1, 0.1, 200, 500, amp);
     
-    fillTime(s,time3,time3 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time3,time3 + 2, amp);
     time3 += 2; amp = 0.08;
-    fillTime(s,time3,time3 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time3,time3 + 2, amp);
     
     time3 += 2;
     
-    fillTime(s,time3,time3 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time3,time3 + 2, amp);
     time3 += 2; amp = 0.07;
     
-    fillTime(s,time3,time3 + 2, rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.00005, 0.006), rand(0.05, 0.6), rand(0.05, 0.6), rand(0.05, 0.6), rand(200, 500), rand(500, 800), amp);
+    fillTimeRandom(s,time3,time3 + 2, amp);
     
     time3 += 2; amp = 0.05;
     
@@ -752,6 +4148,7 @@ int main() {
     
     // ************************************************************************
     // Depressing interlude melody
+    scoreSection(s, "interlude", seed);
     time +=2;
     
     amp = 0.1 ; atk = 0.1 ; dcy = 0.1 ; sus = 0.1 ;
@@ -764,14 +4161,14 @@ int main() {
     for (int i =0; i<12; i++) {
         len = dt * fluteLen[i];
         if ( i == 5)
-            s.add<OscTrm>( time1 ).set(dt * 4, fluteMel[5], amp, len * 0.1 , len * 0.2 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
+            s.note<OscTrm>( time1, dt * 4, fluteMel[5], amp, len * 0.1 , len * 0.2 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
         if ( i == 8)
-            s.add<OscTrm>( time1 ).set(dt * 4, fluteMel[8], amp, len * 0.1 , len * 0.15 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
+            s.note<OscTrm>( time1, dt * 4, fluteMel[8], amp, len * 0.1 , len * 0.15 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
         if (i == 6) { }
         else if (i == 7) { }
         else if (i > 8) { }
         else {
-            s.add<OscTrm>( time1 ).set(len, fluteMel[i], amp, len * 0.1 , len * 0.1 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
+            s.note<OscTrm>( time1, len, fluteMel[i], amp, len * 0.1 , len * 0.1 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
         }
         
         time1 += len;
@@ -782,8 +4179,8 @@ int main() {
 
     for (int i =0; i<12; i++) {
         len = dt * fluteLen[i];
-        s.add<OscTrm>( time1 ).set(len, fluteMel[i], amp, len * 0.12 , len * 0.15 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
-        s.add<OscTrm>( time1 ).set(len, fluteMel2[i], amp, len * 0.12 , len * 0.15 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
+        s.note<OscTrm>( time1, len, fluteMel[i], amp, len * 0.12 , len * 0.15 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
+        s.note<OscTrm>( time1, len, fluteMel2[i], amp, len * 0.12 , len * 0.15 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
         time1 += len;
     }
     
@@ -793,26 +4190,26 @@ int main() {
     float temptime = time1;
     for (int i=0; i<15; i++) {
         freq = fluteMel[i%6] + 1 ; len = 0.5 ;
-        s.add<SineEnv>( temptime ).set( len, freq, 0.1, 0.03, 0.03);
+        s.note<SineEnv>( temptime, len, freq, 0.1, 0.03, 0.03);
         temptime += len;
     }
     for (int i=0; i<15; i++) {
         freq = fluteMel[randint(1,7)] + 1 ; len = 0.5 ;
-        s.add<SineEnv>( temptime ).set( len, freq, 0.15, 0.03, 0.03);
-        s.add<SineEnv>( temptime ).set( len, fluteMel[i%6] + 1, 0.15, 0.03, 0.03);
+        s.note<SineEnv>( temptime, len, freq, 0.15, 0.03, 0.03);
+        s.note<SineEnv>( temptime, len, fluteMel[i%6] + 1, 0.15, 0.03, 0.03);
         temptime += len;
     }
     temptime += 0.25 ;
     for (int i=0; i<7; i++) {
         freq = fluteMel[i%6] + 1 ; len = 0.5 ;
-        s.add<SineEnv>( temptime ).set( len, freq, rand(0.15, 0.22), 0.03, 0.03);
+        s.note<SineEnv>( temptime, len, freq, rand(0.15, 0.22), 0.03, 0.03);
         temptime += len;
     }
     
     for (int i =0; i<12; i++) {
         len = dt * fluteLen[i];
-        s.add<OscTrm>( time1 ).set(len, fluteMel[i], amp, len * 0.1 - 0.05, len * 0.3 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
-        s.add<OscTrm>( time1 ).set(len, fluteMel2[i], amp, len * 0.1 - 0.05, len * 0.3 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
+        s.note<OscTrm>( time1, len, fluteMel[i], amp, len * 0.1 - 0.05, len * 0.3 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
+        s.note<OscTrm>( time1, len, fluteMel2[i], amp, len * 0.1 - 0.05, len * 0.3 , sus, 0.4,4,8,0.5, tbSqr, 0.8);
         time1 += len;
     }
     
@@ -824,12 +4221,14 @@ int main() {
     
     
     // START BASS
+    scoreSection(s, "bass", seed);
+    s.bus("bass");
     tempo = 90;
     dt = (float)60 / tempo ;
 
     for (int i = 0; i<4; i++) {
-        s.add<OscTrm>( time ).set(dt * 4, bassline[i%4], 0.3, dt * 0.05, dt * 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[i%4], 0.3, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[i%4], 0.3, dt * 0.05, dt * 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[i%4], 0.3, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
         time += dt * 4;
     }
     
@@ -837,10 +4236,10 @@ int main() {
     dt = (float)60 / tempo ;
 
     for (int i = 0; i<4; i++) {
-        s.add<OscTrm>( time ).set(dt * 4, bassline[i%4], amp, dt * 0.05, dt * 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[i%4], amp, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[i%4] * 0.5, amp, dt * 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[i%4] * 0.5, amp, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[i%4], amp, dt * 0.05, dt * 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[i%4], amp, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[i%4] * 0.5, amp, dt * 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[i%4] * 0.5, amp, dt * 3   , dt * 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
         time += dt * 4;
     }
     
@@ -848,44 +4247,44 @@ int main() {
     dt = (float)60 / tempo ;
 
     int note = 0;
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.6667, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.6667, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
     time += dt * 4;
     note++;
     
     sus = 0.05 ;
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.8, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.8, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.8, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.8, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
     time += dt * 4;
     note++;
     
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.75, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.75, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.55, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.55, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.75, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.75, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[0] * 0.55, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[0] * 0.55, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
     time += dt * 4;
     note++;
     
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-    s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.6667, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[0] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+    s.note<OscTrm>( time, dt * 4, bassline[0] * 0.6667, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
     time += dt * 4;
     
     note = 0;
@@ -894,66 +4293,68 @@ int main() {
     
     for (int i = 0; i<1; i++) {
         note = 0;
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.6667, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.6667, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
         time += dt * 4;
         note++;
         
         sus = 0.05 ;
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.8, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.8, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.8, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.8, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
         time += dt * 4;
         note++;
         
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.75, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.75, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.55, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.55, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.75, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.75, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[0] * 0.55, amp, 0.05, 0.5 , 0.1, 0.4,4,8,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[0] * 0.55, amp, 3   , 0.05, 0.1, 0.4,4,8,0.5, tbSin, 0.8);
         time += dt * 4;
         note++;
         
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
-        s.add<OscTrm>( time ).set(dt * 4, bassline[0] * 0.6667, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note], amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.5, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[note] * 0.25, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[0] * 0.6667, amp, 0.05, 0.5 , sus, 0.4,8,4,0.5, tbSin, 0.8);
+        s.note<OscTrm>( time, dt * 4, bassline[0] * 0.6667, amp, 3   , 0.05, sus, 0.4,8,4,0.5, tbSin, 0.8);
         time += dt * 4;
         
         note = 0;
         
     }
     // END BASS
+    s.bus(0);
     
     
     
     //FIRST HALF
     //**************************************************************
+    scoreSection(s, "B", seed);
     
     
     len = 4 ; freq = freq * (5/3) ; amp = 0.3 ; atk = 0.2; dcy = 1; sus = 0.1; depth = 0.4; one = 80; two = 80000; rise = 0.5; pan = 0;
-    s.add<OscTrm>( time ).set(len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
-    s.add<OscTrm>( time + 3.4 ).set(len, freq + diff * 15, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
-    s.add<OscTrm>( time + 4.3 ).set(len, freq + diff * 9, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time, len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 3.4, len, freq + diff * 15, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 4.3, len, freq + diff * 9, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
     
     len = 7 ; freq = 512 ; amp = 0.3 ; atk = 0.2; dcy = 1; sus = 0.1; depth = 0.4; one = 80; two = 80000; rise = 0.0; pan = 0;
-    s.add<OscTrm>( time + 8 ).set(len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
-    s.add<OscTrm>( time + 10.4 ).set(len, freq * (1/2), amp, atk, dcy, sus, depth, one, two, 1, tbSin, 0.6);
-    s.add<OscTrm>( time + 14.6 ).set(len, freq * (3/2), amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 8, len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 10.4, len, freq * (1/2), amp, atk, dcy, sus, depth, one, two, 1, tbSin, 0.6);
+    s.note<OscTrm>( time + 14.6, len, freq * (3/2), amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
     
     time += 15 ;
     
@@ -1051,27 +4452,27 @@ int main() {
     time = time2;
     
     len = 4 ; freq = freq * (5/3) ; amp = 0.3 ; atk = 0.2; dcy = 1; sus = 0.1; depth = 0.4; one = 80; two = 80000; rise = 0.5; pan = 0;
-    s.add<OscTrm>( time ).set(len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
-    s.add<OscTrm>( time + 3.4 ).set(len, freq + diff * 15, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
-    s.add<OscTrm>( time + 4.3 ).set(len, freq + diff * 9, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time, len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 3.4, len, freq + diff * 15, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 4.3, len, freq + diff * 9, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
     
     len = 7 ; freq = 620 ; amp = 0.3 ; atk = 0.2; dcy = 1; sus = 0.1; depth = 0.4; one = 80; two = 80000; rise = 0.0; pan = 0;
-    s.add<OscTrm>( time + 8 ).set(len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
-    s.add<OscTrm>( time + 10.4 ).set(len, freq * 0.667, amp, atk, dcy, sus, depth, one, two, 1, tbSin, 0.6);
-    s.add<OscTrm>( time + 14.6 ).set(len, freq * 0.75, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 8, len, freq, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
+    s.note<OscTrm>( time + 10.4, len, freq * 0.667, amp, atk, dcy, sus, depth, one, two, 1, tbSin, 0.6);
+    s.note<OscTrm>( time + 14.6, len, freq * 0.75, amp, atk, dcy, sus, depth, one, two, rise, tbSin, pan);
     
     
     for (int i=0; i<10; i++) {
         len = rand(1.5, 2.4); atk = 0.5; dcy = 0.98; amp = 0.1;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;  amp = 0.1;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
     }
     
@@ -1080,15 +4481,15 @@ int main() {
     for (int i=0; i<10; i++) {
         float a = i * 0.01 ;
         len = rand(1.5, 2.4); atk = 0.5; dcy = 0.98; amp = 0.1 - (a);
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;  amp = 0.05 - (a);
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
     }
     
@@ -1098,15 +4499,15 @@ int main() {
     for (int i=0; i<10; i++) {
         float a = i * 0.01 ;
         len = rand(1.5, 2.4); atk = 0.5; dcy = 0.98; amp = 0.1 - (a);
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;  amp = 0.05 - (a);
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
-        s.add<SineEnv>( time2 ).set( len, freq, amp, atk, dcy);
+        s.note<SineEnv>( time2, len, freq, amp, atk, dcy);
         time2 += dt5 ;
     }
     
@@ -1135,6 +4536,7 @@ int main() {
     
     
     // Repeat A section at 270.
+    scoreSection(s, "A", seed);
     
     time = saveTime2  ;
     tempo = 270 ;
@@ -1872,10 +5274,15 @@ int main() {
     
     s.io().mapAudioIOData<AudioIOData>(io);
 //    s.recordNRT("nlmfinal.wav", 300);
-    s.recordNRT("nlm.wav", 240);
+//    s.recordNRT("nlm.wav", 240);
+    s.recordNRT("nlm.wav", length);
+    
+    if (stats) s.printStats();
+    s.printProfile();
 
 //    
 //    io.start();
 //    printf("\nPress 'enter' to quit...\n");  getchar();
 
 }
+#endif